@@ -2,139 +2,560 @@
 
 #include "shared.h"
 
-const float winscore = 1e9;
-const float drawscore = 0;
+#define bucket_size 4  // number of entries in a bucket of the transposition table
+#define bound_exact 0
+#define bound_lower 1
+#define bound_upper 2
+#define selection_picks 3  // number of moves of a node that are picked by a selection of the best move, after which the remaining moves are sorted
+#define aspiration_window (200 * eval_scale)  // half the width of the initial aspiration window around the score of the previous depth
+#define aspiration_limit (4000 * eval_scale)  // the aspiration window is dropped when it grows wider than this
+#define null_move_reduction 2  // the null move is searched with a depth that is this much smaller than that of the other moves
+#define lmr_moves 3  // number of moves of a node that are searched to full depth before the late move reductions start
+#define lmr_min_depth 3  // the late move reductions are only used at nodes with at least this depth left
+#define futility_margin (600 * eval_scale)  // the quiet moves at a frontier node are skipped if the score of the node is more than this below `alpha`
+#define quiescence_fours 4  // the maximum number of fours the quiescence search makes on a search path
+#define stage_rest 0
+#define stage_counter 1
+#define stage_killer 2
+#define stage_threat 3
 
-int safe_move;
-static int depth;  // depth of the current alpha-beta search
-static int best_move;  // best move found so far, according to the alpha-beta search (it is updated at the moment a new best move is found)
-static List sorted_moves;
+// a helper thread of the (lazy smp) parallel search. it runs its own iterative deepening on a private copy of the board, and shares its results with the other threads through the transposition table
+typedef struct Helper
+{
+  Thread thread;
+  Engine engine;
+  int index;
+  volatile int *stop_signal;  // the helper stops searching as soon as `*stop_signal` becomes non-zero
+  ullong nodes;  // number of nodes visited by the helper
+  int depth;  // the last depth that the helper completed, or 0
+  int score;  // the score of that depth
+  int move;  // the best move of that depth
+  uint seed;  // the seed of the tie-break noise of the evaluation of the helper
+} Helper;
+
+// a move on the move stack. the moves of a node are tried in order of decreasing `stage`, and then in order of decreasing history score `score`
+typedef struct MoveEntry
+{
+  int v;
+  int stage;
+  float score;
+} MoveEntry;
+
+// an entry of the transposition table. `data` contains the score (bits 0-31, as an unsigned integer), the best move (bits 32-47), the depth (bits 48-55), the bound type (bits 56-57) and the age (bits 58-63) of the entry
+// `check` equals `key ^ data`. in this way an entry that got only partly overwritten simply does not match any key
+typedef struct TTEntry
+{
+  ullong check;
+  ullong data;
+} TTEntry;
+
+const int winscore = 1 << 28;  // a position that is won with `e` empty squares left on the board scores `winscore + e`, so a faster win scores higher. every score of the heuristic is smaller than `winscore`
+const int drawscore = 0;
+
+thread_local_ int safe_move;
+int tt_size;  // size of the transposition table in megabytes
+static thread_local_ int depth;  // depth of the current alpha-beta search
+static thread_local_ int best_move;  // best move found so far, according to the alpha-beta search (it is updated at the moment a new best move is found)
+static thread_local_ MoveEntry *move_stack;  // the moves of the nodes on the current search path. the moves of a node are pushed when they are generated and popped when the node returns
+static thread_local_ int move_stack_length;
+static thread_local_ int move_stack_size;
+static thread_local_ int *killers;  // `killers[2 * ply]` and `killers[2 * ply + 1]` are the two most recent moves that caused a cutoff at ply `ply`
+static thread_local_ int *counter_moves;  // `counter_moves[u]` is the most recent move that caused a cutoff right after the opponent made move `u`
+static thread_local_ int ply;  // number of moves made since the root of the search
+static thread_local_ int null_move_ply;  // the ply of the node right after the last null move on the search path. such a node does not try a null move itself
+static thread_local_ int quiescence_depth;  // the number of fours made by the quiescence search on the current search path
+static thread_local_ ullong nodes;  // number of nodes visited by the alpha-beta search of this thread
+static thread_local_ ullong cutoffs;  // number of nodes that were cut off by one of their moves
+static thread_local_ ullong first_move_cutoffs;  // number of nodes that were cut off by their first move
+static thread_local_ ullong cutoff_index_sum;  // the sum of the indices of the moves that caused the cutoffs (starting from 0)
+static Helper *helpers;  // the `threads - 1` helper threads
+static volatile int stop_helpers;  // set when the helper threads should stop searching
+static Helper ponderer;  // the helper thread that searches on the time of the opponent
+static volatile int stop_ponderer;  // set when `ponderer` should stop searching
+static int pondering;  // whether `ponderer` is running
+static int ponder_move;  // the predicted move of the opponent that `ponderer` has already made on its board, or 0 if it searches the position before the move of the opponent
+static ullong ponder_key;  // the key of the position that `ponderer` searches
+static int ponder_depth;  // the depth that `ponderer` completed, if the opponent made the move `ponder_move`. the next search of the position with key `ponder_key` starts at that depth, or at depth 1 if this is 0
+static int ponder_score;  // the score of that depth
+static int ponder_best_move;  // the best move of that depth
+static TTEntry *tt;  // the transposition table. an array of `tt_mask + 1` buckets of `bucket_size` entries
+static ullong tt_mask;
+static int tt_age;  // incremented at each call to `iterative_deepening`. used to replace entries of earlier turns first
+static const ullong active_key = 0x6a09e667f3bcc909ULL;  // part of the key when player 2 is the active player, as the scores depend on the active player
+
+void file_alpha_beta_ini()
+{
+  ullong buckets;
+  tt = 0;
+  tt_mask = 0;
+  tt_age = 0;
+  if (tt_size)
+  {
+    buckets = 1;
+    while (buckets * 2 * bucket_size * sizeof(TTEntry) <= (ullong)tt_size << 20)
+    {
+      buckets *= 2;
+    }
+    tt = (TTEntry *)calloc_safe((size_t)buckets * bucket_size, sizeof(TTEntry));
+    tt_mask = buckets - 1;
+  }
+}
+
+void file_alpha_beta_cleanup()
+{
+  free(tt);
+}
+
+static ullong get_tt_key()
+{
+  return active_id == 2 ? hash ^ active_key : hash;
+}
+
+// looks up the position with key `key` in the transposition table. returns whether it was found
+static int tt_probe(ullong key, int *score, int *move, int *depth, int *bound)
+{
+  TTEntry *bucket;
+  ullong data;
+  int i;
+  bucket = &tt[(key & tt_mask) * bucket_size];
+  for (i = 0; i < bucket_size; i++)
+  {
+    data = bucket[i].data;
+    if ((bucket[i].check ^ data) == key && data)
+    {
+      *score = (int)(uint)data;
+      *move = (int)((data >> 32) & 0xffff);
+      *depth = (int)((data >> 48) & 0xff);
+      *bound = (int)((data >> 56) & 3);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// stores the result of a search of depth `depth` in the transposition table. it replaces an entry of the same position, an empty entry, an entry of an earlier turn, or the entry of the smallest depth (in that order of preference)
+static void tt_store(ullong key, int score, int move, int depth, int bound)
+{
+  TTEntry *bucket, *entry;
+  ullong data;
+  int i, entry_value, value, age;
+  bucket = &tt[(key & tt_mask) * bucket_size];
+  entry = bucket;
+  entry_value = INT_MAX;
+  for (i = 0; i < bucket_size; i++)
+  {
+    data = bucket[i].data;
+    if (!data || (bucket[i].check ^ data) == key)
+    {
+      entry = &bucket[i];
+      break;
+    }
+    age = (int)(data >> 58);
+    value = age == (tt_age & 63) ? (int)((data >> 48) & 0xff) : -1;
+    if (value < entry_value)
+    {
+      entry_value = value;
+      entry = &bucket[i];
+    }
+  }
+  data = (ullong)(uint)score | (ullong)move << 32 | (ullong)min_(depth, 255) << 48 | (ullong)bound << 56 | (ullong)(tt_age & 63) << 58;
+  entry->check = key ^ data;
+  entry->data = data;
+}
 
 int compare_scores(int v, int u)
 {
   return active_player->scores[v] >= active_player->scores[u] ? -1 : 1;
 }
 
-static int compare_scores_ext(int v, int u)
+// returns the upper bound of a null window with lower bound `x`
+static int next_score(int x)
+{
+  return x + 1;
+}
+
+// allocates the move stack, the killer moves and the counter moves of the calling thread
+static void move_stack_ini()
+{
+  move_stack_size = 4 * size;
+  move_stack = (MoveEntry *)malloc_safe(move_stack_size * sizeof(MoveEntry));
+  move_stack_length = 0;
+  killers = (int *)calloc_safe(2 * (size + 1), sizeof(int));
+  counter_moves = (int *)calloc_safe(size, sizeof(int));
+  ply = 0;
+  null_move_ply = -1;
+  quiescence_depth = 0;
+  cutoffs = 0;
+  first_move_cutoffs = 0;
+  cutoff_index_sum = 0;
+}
+
+static void move_stack_cleanup()
+{
+  free(move_stack);
+  free(killers);
+  free(counter_moves);
+}
+
+// returns the move of the opponent that led to the current node, or 0 if there is none (as at the node after a null move)
+static int last_move()
+{
+  return turn && ply != null_move_ply ? abs(moves[turn - 1]) : 0;
+}
+
+// pushes the candidate moves except `hash_move` onto the move stack and returns their number. the moves that make a four come first, then the killer moves of the current ply, then the counter move of the last move, and then the other moves by their history score
+// the move stack only grows if the search path holds more moves than ever before, so there is no allocation once the search is underway
+static int generate_moves(int hash_move)
+{
+  int v, count, counter_move;
+  MoveEntry *m;
+  if (move_stack_length + empty_squares > move_stack_size)
+  {
+    move_stack_size = 2 * (move_stack_length + empty_squares);
+    move_stack = (MoveEntry *)realloc_safe(move_stack, move_stack_size * sizeof(MoveEntry));
+  }
+  m = move_stack + move_stack_length;
+  count = 0;
+  counter_move = counter_moves[last_move()];
+  for (v = first_candidate(); v; v = next_candidate(v))
+  {
+    if (v == hash_move)
+    {
+      continue;
+    }
+    m[count].v = v;
+    m[count].score = active_player->scores[v];
+    if (p->fours[v].length)
+    {
+      m[count].stage = stage_threat;
+    }
+    else if (v == killers[2 * ply] || v == killers[2 * ply + 1])
+    {
+      m[count].stage = stage_killer;
+    }
+    else if (v == counter_move)
+    {
+      m[count].stage = stage_counter;
+    }
+    else
+    {
+      m[count].stage = stage_rest;
+    }
+    count++;
+  }
+  move_stack_length += count;
+  return count;
+}
+
+static int is_better_move(MoveEntry *a, MoveEntry *b)
 {
-  if (v == best_move)
+  return a->stage > b->stage || (a->stage == b->stage && a->score > b->score);
+}
+
+// returns the `k`-th move of the `count` moves starting at `m`, assuming the moves before it are already in order. as most nodes are cut off after a few moves, the first moves are found by a selection of the best remaining move, and only then the remaining moves are sorted
+static int pick_move(MoveEntry *m, int k, int count)
+{
+  int i, j;
+  MoveEntry x;
+  if (k < selection_picks)
   {
-    return  -1;
+    j = k;
+    for (i = k + 1; i < count; i++)
+    {
+      if (is_better_move(&m[i], &m[j]))
+      {
+        j = i;
+      }
+    }
+    x = m[k];
+    m[k] = m[j];
+    m[j] = x;
   }
-  else if (u == best_move)
+  else if (k == selection_picks)
   {
-    return 1;
+    for (i = k + 1; i < count; i++)
+    {
+      x = m[i];
+      for (j = i; j > k && is_better_move(&x, &m[j - 1]); j--)
+      {
+        m[j] = m[j - 1];
+      }
+      m[j] = x;
+    }
   }
-  else
+  return m[k].v;
+}
+
+// records the move `v` that caused a cutoff at the current ply
+static void add_killer(int v)
+{
+  if (killers[2 * ply] != v)
   {
-    return active_player->scores[v] >= active_player->scores[u] ? -1 : 1;
+    killers[2 * ply + 1] = killers[2 * ply];
+    killers[2 * ply] = v;
   }
 }
 
-static void sort_moves()
+// pushes the moves that make a four onto the move stack and returns their number
+static int generate_fours()
 {
-  int v;
-  list_clear(&sorted_moves);
-  for (v = v0; v < v1; v++)
+  int i, j, k, v, count;
+  List *fours;
+  MoveEntry *m;
+  m = move_stack + move_stack_length;
+  count = 0;
+  // every four is a pair of squares, of which the smaller one is in `p->fl`
+  for (i = 0; i < p->fl.length; i++)
   {
-    if (!board[v])
+    v = p->fl.values[i];
+    fours = &p->fours[v];
+    for (j = -1; j < fours->length; j++)
     {
-      list_ordered_add_custom(&sorted_moves, v, compare_scores_ext);
+      v = j == -1 ? p->fl.values[i] : fours->values[j];
+      for (k = 0; k < count && m[k].v != v; k++);
+      if (k < count)
+      {
+        continue;
+      }
+      if (move_stack_length + count == move_stack_size)
+      {
+        move_stack_size *= 2;
+        move_stack = (MoveEntry *)realloc_safe(move_stack, move_stack_size * sizeof(MoveEntry));
+        m = move_stack + move_stack_length;
+      }
+      m[count].v = v;
+      m[count].stage = p->fours[v].length >= 2 ? stage_threat : stage_rest;
+      m[count].score = active_player->scores[v];
+      count++;
     }
   }
+  move_stack_length += count;
+  return count;
 }
 
-float alpha_beta(float alpha, float beta, int depth_left, int first_call)
+// the quiescence search, which replaces the evaluation at the leaves of alpha-beta. the player to move may either accept the evaluation of the position, or make a four first. the opponent then has a single reply, after which the quiescence search continues. in this way the leaves do not hide a winning sequence of fours just beyond the horizon
+// assumes the position is not decided within 3 moves
+static int quiescence(int alpha, int beta)
 {
-  float score;
-  int k, alpha_move, v;
-  List *moves, _moves;
+  int score;
+  int k, v, base, count;
+  score = active_player->heuristic();
+  if (score >= beta || !p->fl.length || quiescence_depth == quiescence_fours)
+  {
+    return truncate(score, alpha, beta);
+  }
+  alpha = max_(alpha, score);
+  base = move_stack_length;
+  count = generate_fours();
+  for (k = 0; k < count; k++)
+  {
+    v = pick_move(move_stack + base, k, count);
+    submit_move(v);
+    ply++;
+    quiescence_depth++;
+    score = -active_player->alpha_beta(-beta, -alpha, 0, 0);
+    quiescence_depth--;
+    ply--;
+    undo_move();
+    if (out_of_time)
+    {
+      move_stack_length = base;
+      return -INT_MAX;
+    }
+    if (score >= beta)
+    {
+      move_stack_length = base;
+      return beta;
+    }
+    alpha = max_(alpha, score);
+  }
+  move_stack_length = base;
+  return alpha;
+}
+
+int alpha_beta(int alpha, int beta, int depth_left, int first_call)
+{
+  int score, alpha_before, tt_score;
+  int k, alpha_move, v, hash_move, tt_depth, tt_bound, base, count, searched, futile, reduction, null_move_ply_before;
+  ullong key;
+  nodes++;
   if (is_out_of_time())
   {
     return 0;
   }
   if (winner == 3 - pid)
   {
-    return truncate(-winscore * empty_squares, alpha, beta);
+    return truncate(-winscore - empty_squares, alpha, beta);
   }
   else if (winner == draw)
   {
-    return truncate(drawscore * empty_squares, alpha, beta);
+    return truncate(drawscore, alpha, beta);
   }
   else if (p->fives.length)
   {
-    return truncate(winscore * (empty_squares - 1), alpha, beta);
+    return truncate(winscore + empty_squares - 1, alpha, beta);
   }
   else if (q->fives.length >= 2)
   {
-    return truncate(-winscore * (empty_squares - 2), alpha, beta);
+    return truncate(-winscore - (empty_squares - 2), alpha, beta);
   }
   else if (win_in_3(pid))
   {
-    return truncate(winscore * (empty_squares - 3), alpha, beta);
+    return truncate(winscore + empty_squares - 3, alpha, beta);
   }
   else if (q->fives.length == 1)
   {
     v = q->fives.values[0];
     active_player->scores[v]++;
     submit_move(v);
+    ply++;
     score = -active_player->alpha_beta(-beta, -alpha, depth_left, 0);
+    ply--;
     undo_move();
     return score;
   }
   else if (!depth_left)
   {
+    if (active_player->quiescence_search)
+    {
+      return quiescence(alpha, beta);
+    }
     return truncate(active_player->heuristic(), alpha, beta);
   }
-  alpha_move = 0;
-  if (!first_call && depth_left > 1)
+  hash_move = 0;
+  key = 0;
+  if (tt)
   {
-    moves = &_moves;
-    list_ini(moves, empty_squares);
-    for (k = 0; k < sorted_moves.length; k++)
+    key = get_tt_key();
+    if (!first_call && tt_probe(key, &tt_score, &hash_move, &tt_depth, &tt_bound) && hash_move < v1)
     {
-      v = sorted_moves.values[k];
-      if (!board[v] && nearby[v])
+      if (tt_depth >= depth_left)
       {
-        if (moves->length && compare_scores(list_peak(moves), v) < 0)
+        if (tt_bound == bound_exact)
         {
-          list_add(moves, v);
+          return truncate(tt_score, alpha, beta);
         }
-        else
+        else if (tt_bound == bound_lower && tt_score >= beta)
         {
-          list_ordered_add_custom(moves, v, compare_scores);
+          return beta;
+        }
+        else if (tt_bound == bound_upper && tt_score <= alpha)
+        {
+          return alpha;
         }
       }
     }
+    else
+    {
+      hash_move = 0;
+    }
   }
-  else
+  // null move pruning: if the position is still at least `beta` after passing the turn and searching with a reduced depth, then it is cut off. as passing skips the threats of the opponent, this is only done if neither side can make a four
+  if (active_player->null_move_pruning && !first_call && depth_left > null_move_reduction && ply != null_move_ply && beta < winscore && !p->fl.length && !q->fl.length)
+  {
+    null_move_ply_before = null_move_ply;
+    set_p(3 - pid);
+    ply++;
+    null_move_ply = ply;
+    score = -active_player->alpha_beta(-beta, next_score(-beta), depth_left - 1 - null_move_reduction, 0);
+    null_move_ply = null_move_ply_before;
+    ply--;
+    set_p(3 - pid);
+    if (out_of_time)
+    {
+      return -INT_MAX;
+    }
+    if (score >= beta)
+    {
+      return beta;
+    }
+  }
+  // futility pruning: at a frontier node that is far below `alpha`, only the moves that make or stop a four can still reach `alpha`
+  futile = active_player->futility_pruning && !first_call && depth_left == 1 && alpha > -winscore && active_player->heuristic() + futility_margin <= alpha;
+  alpha_before = alpha;
+  alpha_move = 0;
+  if (first_call)
   {
-    moves = &sorted_moves;
+    hash_move = best_move;
   }
-  for (k = 0; k < moves->length; k++)
+  // the hash move (the best move of an earlier search of this position) is tried first, such that the other moves need not be generated if it causes a cutoff
+  base = move_stack_length;
+  count = -1;
+  searched = 0;
+  for (k = hash_move ? -1 : 0; k < count || count == -1; k++)
   {
-    v = moves->values[k];
-    if (moves == &sorted_moves && (board[v] || !nearby[v]))
+    if (k == -1)
     {
-      continue;
+      v = hash_move;
+      if (board[v] || !nearby[v])
+      {
+        continue;
+      }
+    }
+    else
+    {
+      if (count == -1)
+      {
+        count = generate_moves(hash_move);
+        if (!count)
+        {
+          break;
+        }
+      }
+      v = pick_move(move_stack + base, k, count);
+      if (futile && !p->fours[v].length && !q->fours[v].length)
+      {
+        continue;
+      }
     }
+    // late move reductions: a quiet move late in the move order (which is by history score) is first searched with a reduced depth, and only searched to full depth if it turns out to be better than `alpha`
+    reduction = active_player->late_move_reductions && k >= lmr_moves && depth_left >= lmr_min_depth && move_stack[base + k].stage == stage_rest && !q->fours[v].length;
     submit_move(v);
-    score = -active_player->alpha_beta(-beta, -alpha, depth_left - 1, 0);
-    undo_move();
-    if (out_of_time)
+    ply++;
+    // principal variation search: the first move is searched with the full window, and every other move is only tested to be no better than `alpha` with a null window. only a move that fails this test is searched again with the full window
+    if (!searched)
+    {
+      score = -active_player->alpha_beta(-beta, -alpha, depth_left - 1, 0);
+    }
+    else
     {
-      if (moves == &_moves)
+      score = -active_player->alpha_beta(-next_score(alpha), -alpha, depth_left - 1 - reduction, 0);
+      if (reduction && score > alpha && !out_of_time)
+      {
+        score = -active_player->alpha_beta(-next_score(alpha), -alpha, depth_left - 1, 0);
+      }
+      if (score > alpha && score < beta && !out_of_time)
       {
-        list_cleanup(moves);
+        score = -active_player->alpha_beta(-beta, -alpha, depth_left - 1, 0);
       }
-      return -FLT_MAX;
+    }
+    searched++;
+    ply--;
+    undo_move();
+    if (out_of_time)
+    {
+      move_stack_length = base;
+      return -INT_MAX;
     }
     if (score >= beta)
     {
       active_player->scores[v]++;
-      if (moves == &_moves)
+      if (first_call)
+      {
+        best_move = v;
+      }
+      if (!p->fours[v].length)
       {
-        list_cleanup(moves);
+        add_killer(v);
+        counter_moves[last_move()] = v;
+      }
+      cutoffs++;
+      first_move_cutoffs += searched == 1;
+      cutoff_index_sum += searched - 1;
+      move_stack_length = base;
+      if (tt)
+      {
+        tt_store(key, beta, v, depth_left, bound_lower);
       }
       return beta;
     }
@@ -152,20 +573,195 @@ float alpha_beta(float alpha, float beta, int depth_left, int first_call)
   {
     active_player->scores[alpha_move]++;
   }
-  if (moves == &_moves)
+  move_stack_length = base;
+  if (tt)
   {
-    list_cleanup(moves);
+    tt_store(key, alpha, alpha_move, depth_left, alpha > alpha_before ? bound_exact : bound_upper);
   }
   return alpha;
 }
 
+// runs the alpha-beta search of depth `depth` with an aspiration window around `score`, the score of the previous depth. the window is widened until the score falls inside it
+static int aspiration_search(int score)
+{
+  int alpha, beta, delta, ans;
+  delta = aspiration_window;
+  if (depth >= 3 && abs(score) < winscore)
+  {
+    alpha = score - delta;
+    beta = score + delta;
+  }
+  else
+  {
+    alpha = -INT_MAX;
+    beta = INT_MAX;
+  }
+  for (;;)
+  {
+    ans = active_player->alpha_beta(alpha, beta, depth, 1);
+    if (out_of_time)
+    {
+      return ans;
+    }
+    delta *= 4;
+    if (ans <= alpha && alpha > -INT_MAX)
+    {
+      alpha = delta > aspiration_limit ? -INT_MAX : ans - delta;
+    }
+    else if (ans >= beta && beta < INT_MAX)
+    {
+      beta = delta > aspiration_limit ? INT_MAX : ans + delta;
+    }
+    else
+    {
+      return ans;
+    }
+  }
+}
+
+static void run_helper(void *arg)
+{
+  Helper *helper;
+  int score;
+  helper = (Helper *)arg;
+  engine_load(&helper->engine);
+  engine_thread_ini();
+  stop_signal = helper->stop_signal;
+  seed_line_heur(helper->seed);
+  set_time_limit(1e9);
+  if (active_player->track_board_value)
+  {
+    start_tracking_board_value();
+  }
+  nodes = 0;
+  best_move = 0;
+  score = 0;
+  helper->depth = 0;
+  move_stack_ini();
+  // half of the helpers skip depth 1, such that the threads are spread over different depths
+  for (depth = 1 + helper->index % 2; depth <= empty_squares; depth++)
+  {
+    score = aspiration_search(score);
+    if (out_of_time)
+    {
+      break;
+    }
+    helper->depth = depth;
+    helper->score = score;
+    helper->move = best_move;
+    if (score >= winscore || score <= -winscore)
+    {
+      break;
+    }
+  }
+  move_stack_cleanup();
+  if (track_board_value)
+  {
+    stop_tracking_board_value();
+  }
+  engine_thread_cleanup();
+  helper->nodes = nodes;
+  engine_save(&helper->engine);
+  engine_free(&helper->engine);
+}
+
+// starts `threads - 1` helper threads that search the current position
+static void start_helpers()
+{
+  int i;
+  stop_helpers = 0;
+  helpers = (Helper *)calloc_safe(threads - 1, sizeof(Helper));
+  for (i = 0; i < threads - 1; i++)
+  {
+    helpers[i].index = i;
+    helpers[i].stop_signal = &stop_helpers;
+    helpers[i].seed = (uint)rand();
+    engine_copy(&helpers[i].engine);
+    thread_start(&helpers[i].thread, run_helper, &helpers[i]);
+  }
+}
+
+// stops the helper threads and returns the number of nodes they visited
+static ullong join_helpers()
+{
+  int i;
+  ullong ans;
+  stop_helpers = 1;
+  ans = 0;
+  for (i = 0; i < threads - 1; i++)
+  {
+    thread_join(&helpers[i].thread);
+    ans += helpers[i].nodes;
+  }
+  free(helpers);
+  return ans;
+}
+
+// starts to search on the time of the opponent, who is about to make a move. if the transposition table predicts the move of the opponent, then the position after that move is searched. otherwise the position before it is searched. the search runs until `stop_pondering` is called
+void start_pondering()
+{
+  int score;
+  int move, tt_depth, bound;
+  stop_pondering(0);
+  if (!tt || winner || !active_player)
+  {
+    return;
+  }
+  ponder_move = 0;
+  if (tt_probe(get_tt_key(), &score, &move, &tt_depth, &bound) && move && !board[move] && nearby[move])
+  {
+    ponder_move = move;
+  }
+  if (ponder_move)
+  {
+    submit_move(ponder_move);
+  }
+  if (!winner)
+  {
+    stop_ponderer = 0;
+    ponderer.index = 0;
+    ponderer.stop_signal = &stop_ponderer;
+    ponderer.seed = (uint)rand();
+    ponder_key = get_tt_key();
+    engine_copy(&ponderer.engine);
+    thread_start(&ponderer.thread, run_helper, &ponderer);
+    pondering = 1;
+  }
+  if (ponder_move)
+  {
+    undo_move();
+  }
+}
+
+// stops the pondering search, as the opponent made move `v`, or as the game changed in some other way if `v == 0`. if the prediction of the move was right, then the pondering searched the position of the next turn. its results are in the transposition table, and the search of the next turn takes over from the depth it completed
+void stop_pondering(int v)
+{
+  int hit;
+  if (!pondering)
+  {
+    return;
+  }
+  stop_ponderer = 1;
+  thread_join(&ponderer.thread);
+  pondering = 0;
+  hit = v && v == ponder_move;
+  ponder_depth = hit && ponderer.move ? ponderer.depth : 0;
+  ponder_score = ponderer.score;
+  ponder_best_move = ponderer.move;
+  if (ultra_verbose && !brain)
+  {
+    print_("pondering visited %llu nodes%s", ponderer.nodes, hit ? " (the predicted move was played)" : "");
+  }
+}
+
 // the iterative deepening procedure, or a fixed depth search if `active_player->fixed_depth > 0`
 // if `final_move` is set then the log messages reflect the fact that the move returned by this function is the move `active_player` is going to make
 // assumes `!p->fives.length`
 int iterative_deepening(char *safeties)
 {
-  float score, ans;
-  int v, safe_move_depth;
+  float start_time;
+  int score, ans, v, safe_move_depth, prev_best_move, ponder_start;
+  ullong total_nodes;
   for (v = v0; v < v1; v++)
   {
     active_player->scores[v] /= 1e9;
@@ -178,20 +774,53 @@ int iterative_deepening(char *safeties)
   {
     set_time_limit(1e9);
   }
+  else
+  {
+    set_soft_deadline();
+  }
   depth = 1;
   best_move = 0;
   safe_move_depth = 0;
+  tt_age++;
+  seed_line_heur((uint)rand());
   score = 0;
-  list_ini(&sorted_moves, empty_squares);
+  ponder_start = 0;
+  // after a ponder hit, the depths that the pondering search completed are only searched again from the largest one, which mostly consists of lookups in the transposition table. its best move is tried first
+  if (ponder_depth && ponder_key == get_tt_key())
+  {
+    depth = active_player->fixed_depth ? min_(ponder_depth, active_player->fixed_depth) : ponder_depth;
+    ponder_start = depth;
+    score = ponder_score;
+    best_move = ponder_best_move;
+  }
+  ponder_depth = 0;
+  move_stack_ini();
+  start_time = get_time();
+  nodes = 0;
+  if (threads > 1)
+  {
+    start_helpers();
+  }
   while (depth <= empty_squares)
   {
-    sort_moves();
-    ans = active_player->alpha_beta(-FLT_MAX, FLT_MAX, depth, 1);
+    prev_best_move = best_move;
+    ans = aspiration_search(score);
     if (out_of_time)
     {
+      // if the first depth after a ponder hit is not finished, then the result of the pondering counts as the depth before it
+      if (depth == ponder_start)
+      {
+        best_move = ponder_best_move;
+        score = ponder_score;
+      }
       break;
     }
     score = ans;
+    // the best move is unstable, so it gets some more time to settle
+    if (depth > 3 && prev_best_move && best_move != prev_best_move)
+    {
+      extend_turn(0.5f);
+    }
     if (active_player->play_safe_move && safe_move)
     {
       if (score >= winscore)
@@ -209,13 +838,27 @@ int iterative_deepening(char *safeties)
       }
     }
     depth++;
-    if (score >= winscore || score <= -winscore || (active_player->fixed_depth && depth > active_player->fixed_depth))
+    if (score >= winscore || score <= -winscore || (active_player->fixed_depth && depth > active_player->fixed_depth) || is_past_soft_deadline())
     {
       break;
     }
   }
   depth--;
-  list_cleanup(&sorted_moves);
+  total_nodes = nodes;
+  if (threads > 1)
+  {
+    total_nodes += join_helpers();
+  }
+  if (ultra_verbose)
+  {
+    print_("alpha-beta visited %llu nodes on %d threads (%.0f nodes/sec)", total_nodes, threads, total_nodes / max_(get_time() - start_time, 1e-3f));
+    if (cutoffs)
+    {
+      print_("%.1f%% of the cutoffs by the first move (average index of the cutoff move %.2f)", 100.0 * first_move_cutoffs / cutoffs, (double)cutoff_index_sum / cutoffs);
+    }
+  }
+  move_stack_cleanup();
+  // the lines of the board value are kept, and caught up with the moves of the game at the next search
   if (track_board_value)
   {
     stop_tracking_board_value();
@@ -236,20 +879,20 @@ int iterative_deepening(char *safeties)
     }
     if (verbose)
     {
-      score = fabs(score) <= 0.05 ? 0 : score;
-      if (depth == empty_squares)
+      // a win or a loss is reported by the number of moves until it, as its score only encodes that number
+      if (score >= winscore || score <= -winscore)
       {
-        print_("alpha-beta of depth %d (full depth) returned a score of %.1f", depth, score);
+        print_("alpha-beta of depth %d%s returned a %s in %d", depth, depth == empty_squares ? " (full depth)" : "", score > 0 ? "win" : "loss", empty_squares - (abs(score) - winscore));
       }
-      else
+      else if (depth == empty_squares)
       {
-        print_("alpha-beta of depth %d returned a score of %.1f", depth, score);
+        print_("alpha-beta of depth %d (full depth) returned a score of %.1f", depth, (float)score / eval_scale);
       }
-      if (score >= winscore)
+      else
       {
-        print_("win in %d", empty_squares - (int)(score / winscore));
+        print_("alpha-beta of depth %d returned a score of %.1f", depth, (float)score / eval_scale);
       }
-      else if (v == best_move && active_player->play_safe_move && safe_move)
+      if (v == best_move && active_player->play_safe_move && safe_move)
       {
         print_("playing the returned move (a safe move)");
       }
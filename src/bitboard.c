@@ -0,0 +1,76 @@
+// for each player, the stones of the player on every line of the playing field (the rows, the columns and both diagonals) are stored as a sequence of bits
+// every line includes its two border squares. as these are never set in the bits of a player, a run of set bits never continues into the next line. the border squares are set in the bits of the blocks, so that they count as occupied when the squares around a square are read from the bits. this allows us to compute the length of a row of stones with a single count of trailing or leading ones, instead of walking over the board square by square
+// in addition, the candidate moves (the empty squares near a stone) are kept up to date by `update_nearby` as two bitsets over the squares: the squares with `nearby[v] > 0`, and the occupied squares. the candidate moves can then be visited without looking at the other squares
+
+#include "shared.h"
+
+thread_local_ ullong *line_bits;  // the bits of player 1, followed by the bits of player 2 and the bits of the blocks (the stones with value 3)
+int line_bits_size;  // the number of words of `line_bits`
+thread_local_ ullong *near_bits;  // bit `v` is set if and only if `nearby[v] > 0`
+thread_local_ ullong *occupied_bits;  // bit `v` is set if and only if `board[v]` is not empty, or `v` lies outside of the board. so the candidate moves are the bits of `near_bits & ~occupied_bits`
+int candidate_words;  // the number of words of a bitset over the squares
+int player_words;  // the number of words used for the bits of a single player. the lines are preceded and followed by an unused word, so that the 64 bits on both sides of a square can always be read
+int line_words;  // the number of words used for the bits of a single line
+int *bit_index;  // `bit_index[4 * v + dir]` is the index of the bit of square `v` on its line in the direction with index `dir`
+int *dir_of;  // `dir_of[d + w + 1]` equals `dir + 1` if `d` is the direction with index `dir`, `-dir - 1` if `-d` is, and 0 otherwise
+
+// the directions are 1, w, 1 + w, 1 - w. along each line the index of the bits increases in the direction
+void file_bitboard_ini()
+{
+  int v, x, y, lines;
+  int starts[4];
+  line_words = (max_(w, h) + 63) / 64;
+  starts[0] = 0;
+  starts[1] = starts[0] + h;
+  starts[2] = starts[1] + w;
+  starts[3] = starts[2] + w + h - 1;
+  lines = starts[3] + w + h - 1;
+  player_words = lines * line_words + 2;
+  line_bits_size = 3 * player_words;
+  bit_index = (int *)malloc_safe(4 * size * sizeof(int));
+  for (v = 0; v < size; v++)
+  {
+    x = v % w;
+    y = v / w;
+    bit_index[4 * v] = 64 + (starts[0] + y) * line_words * 64 + x;
+    bit_index[4 * v + 1] = 64 + (starts[1] + x) * line_words * 64 + y;
+    bit_index[4 * v + 2] = 64 + (starts[2] + x - y + h - 1) * line_words * 64 + y;
+    bit_index[4 * v + 3] = 64 + (starts[3] + x + y) * line_words * 64 + x;
+  }
+  dir_of = (int *)calloc_safe(2 * w + 3, sizeof(int));
+  dir_of[w + 2] = 1;
+  dir_of[2 * w + 1] = 2;
+  dir_of[2 * w + 2] = 3;
+  dir_of[2] = 4;
+  dir_of[w] = -1;
+  dir_of[1] = -2;
+  dir_of[0] = -3;
+  dir_of[2 * w] = -4;
+  line_bits = (ullong *)calloc_safe(line_bits_size, sizeof(ullong));
+  for (v = 0; v < size; v++)
+  {
+    if (v % w == 0 || v % w == w - 1 || v < w || v >= size - w)
+    {
+      bitboard_flip(v, 3);
+    }
+  }
+  candidate_words = (size + 63) / 64;
+  near_bits = (ullong *)calloc_safe(candidate_words, sizeof(ullong));
+  occupied_bits = (ullong *)calloc_safe(candidate_words, sizeof(ullong));
+  for (v = 0; v < 64 * candidate_words; v++)
+  {
+    if (v >= size || v % w == 0 || v % w == w - 1 || v < w || v >= size - w)
+    {
+      occupied_bits[v >> 6] |= 1ULL << (v & 63);
+    }
+  }
+}
+
+void file_bitboard_cleanup()
+{
+  free(bit_index);
+  free(dir_of);
+  free(line_bits);
+  free(near_bits);
+  free(occupied_bits);
+}
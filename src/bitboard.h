@@ -0,0 +1,196 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+// the inline part of bitboard.c. these functions are called in the innermost loops of the threat detection and the move generation, so they are defined here to allow the compiler to inline them
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+extern int player_words;
+extern int line_words;
+extern int *bit_index;
+extern int *dir_of;
+
+#ifdef _MSC_VER
+static inline int ctz64(ullong x)
+{
+  unsigned long i;
+  _BitScanForward64(&i, x);
+  return (int)i;
+}
+
+static inline int clz64(ullong x)
+{
+  unsigned long i;
+  _BitScanReverse64(&i, x);
+  return 63 - (int)i;
+}
+#else
+#define ctz64(x) __builtin_ctzll(x)
+#define clz64(x) __builtin_clzll(x)
+#endif
+
+// returns the bits of player `id`, or the bits of the blocks if `id == 3`
+static inline ullong *player_bits(char id)
+{
+  return line_bits + (id - 1) * player_words;
+}
+
+// adds or removes a stone of player `id` (or a block if `id == 3`) at square `v`
+static inline void bitboard_flip(int v, char id)
+{
+  int dir, i;
+  ullong *bits;
+  bits = player_bits(id);
+  for (dir = 0; dir < 4; dir++)
+  {
+    i = bit_index[4 * v + dir];
+    bits[i >> 6] ^= 1ULL << (i & 63);
+  }
+}
+
+// returns the smallest candidate move larger than `v`, or 0 if no such move exists. the candidate moves are visited in ascending order by `for (v = first_candidate(); v; v = next_candidate(v))`. the loop only reads the candidate moves, so it may be nested, as long as the moves made inside it are undone before the next step
+static inline int next_candidate(int v)
+{
+  int k;
+  ullong x;
+  v++;
+  k = v >> 6;
+  if (k >= candidate_words)
+  {
+    return 0;
+  }
+  x = near_bits[k] & ~occupied_bits[k] & (~0ULL << (v & 63));
+  while (!x)
+  {
+    if (++k == candidate_words)
+    {
+      return 0;
+    }
+    x = near_bits[k] & ~occupied_bits[k];
+  }
+  return k * 64 + ctz64(x);
+}
+
+// returns the smallest candidate move, or 0 if there are none
+static inline int first_candidate()
+{
+  return next_candidate(0);
+}
+
+// returns the number of consecutive set bits at the indices i, i+1, i+2, ...
+static inline int run_up(const ullong *bits, int i)
+{
+  int len, r, c;
+  ullong x;
+  len = 0;
+  for (;;)
+  {
+    r = i & 63;
+    x = ~(bits[i >> 6] >> r);
+    c = x ? ctz64(x) : 64;
+    len += c;
+    if (c < 64 - r)
+    {
+      return len;
+    }
+    i += c;
+  }
+}
+
+// returns the number of consecutive set bits at the indices i, i-1, i-2, ...
+static inline int run_down(const ullong *bits, int i)
+{
+  int len, r, c;
+  ullong x;
+  len = 0;
+  for (;;)
+  {
+    r = i & 63;
+    x = ~(bits[i >> 6] << (63 - r));
+    c = x ? clz64(x) : 64;
+    len += c;
+    if (c < r + 1)
+    {
+      return len;
+    }
+    i -= c;
+  }
+}
+
+// returns the 64 bits at the indices i, i+1, ..., i+63, with bit `i` as the lowest bit. as the lines are padded by a word on both sides, `i` may lie up to 64 bits before the first line and anywhere on the last one
+static inline ullong load_bits(const ullong *bits, int i)
+{
+  int r;
+  r = i & 63;
+  return r ? bits[i >> 6] >> r | bits[(i >> 6) + 1] << (64 - r) : bits[i >> 6];
+}
+
+// the squares on both sides of a square `v` on one of its lines, as seen by a player. side 0 holds the squares v+d, v+2d, ..., v+64d, side 1 holds the squares v-d, v-2d, ..., v-64d, where `d` is the direction the window was loaded in
+// a side is a word of the line bits, so its squares are stored from the lowest bit up if the bit index increases away from `v`, and from the highest bit down otherwise. the border squares of the line are never empty, so a run of squares stops at the end of the line
+typedef struct
+{
+  ullong own[2];  // the squares with a stone of the player
+  ullong empty[2];  // the empty squares
+  char up[2];  // whether the squares of the side are stored from the lowest bit up
+} LineWindow;
+
+// loads the window of player `id` around square `v` on its line in the direction `d`
+static inline void load_window(LineWindow *lw, int v, int d, char id)
+{
+  int k, i, j, s;
+  ullong own;
+  k = dir_of[d + w + 1];
+  i = bit_index[4 * v + (k > 0 ? k : -k) - 1];
+  for (s = 0; s < 2; s++)
+  {
+    lw->up[s] = (char)((k > 0) == (s == 0));
+    j = lw->up[s] ? i + 1 : i - 64;
+    own = load_bits(player_bits(id), j);
+    lw->own[s] = own;
+    lw->empty[s] = ~(own | load_bits(player_bits((char)(3 - id)), j) | load_bits(player_bits(3), j));
+  }
+}
+
+// returns the number of consecutive set squares of the side `x` of a window, starting with the square at distance `k + 1` from `v`. `up` is the order of the side
+static inline int window_run(ullong x, char up, int k)
+{
+  if (k >= 64)
+  {
+    return 0;
+  }
+  x = ~(up ? x >> k : x << k);
+  return x ? (up ? ctz64(x) : clz64(x)) : 64;
+}
+
+// returns whether the square at distance `k + 1` from `v` is set in the side `x` of a window
+static inline int window_test(ullong x, char up, int k)
+{
+  return k < 64 && (up ? x >> k : x >> (63 - k)) & 1;
+}
+
+// returns how many squares with value `id` exist before a square with some other value occurs in the sequence v+d, v+d+d, v+d+d+d, ...
+static inline int tail_length(int v, int d, char id)
+{
+  int k, len;
+  k = d >= -w - 1 && d <= w + 1 ? dir_of[d + w + 1] : 0;
+  if (k && (id == 1 || id == 2))
+  {
+    if (k > 0)
+    {
+      return run_up(player_bits(id), bit_index[4 * v + k - 1] + 1);
+    }
+    return run_down(player_bits(id), bit_index[4 * v - k - 1] - 1);
+  }
+  len = 0;
+  v += d;
+  while (board[v] == id)
+  {
+    len++;
+    v += d;
+  }
+  return len;
+}
+
+#endif
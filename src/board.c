@@ -17,30 +17,88 @@ void board_clear(char *board)
   }
 }
 
-// returns how many squares with value `id` exist before a square with some other value occurs in the sequence v+d, v+d+d, v+d+d+d, ...
-int tail_length(int v, int d, char id)
+// returns the next value of a splitmix64 sequence with state `*x`
+static ullong next_random64(ullong *x)
 {
-  int len;
-  len = 0;
-  v += d;
-  while (board[v] == id)
+  ullong z;
+  z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// fills the zobrist keys and sets `hash` to the key of an empty board. uses a fixed seed, so that the keys do not depend on (and do not disturb) the random number generator of the game
+void zobrist_ini()
+{
+  int i;
+  ullong x;
+  x = 0;
+  for (i = 0; i < 4 * size; i++)
+  {
+    zobrist[i] = next_random64(&x);
+  }
+  zobrist_side = next_random64(&x);
+  hash = pid == 2 ? zobrist_side : 0;
+}
+
+// executes `nearby[u] += d` for the square `u`, and updates its bit in `near_bits`
+static inline void update_nearby_square(int u, int d)
+{
+  if (d > 0)
   {
-    len++;
-    v += d;
+    if (!nearby[u]++)
+    {
+      near_bits[u >> 6] |= 1ULL << (u & 63);
+    }
+  }
+  else if (!--nearby[u])
+  {
+    near_bits[u >> 6] &= ~(1ULL << (u & 63));
   }
-  return len;
 }
 
+// sets the bits of the squares `u`, ..., `u + 4` in `near_bits` to `bits`
+static inline void set_near_row(int u, ullong bits)
+{
+  int k, r;
+  k = u >> 6;
+  r = u & 63;
+  near_bits[k] = (near_bits[k] & ~(31ULL << r)) | bits << r;
+  if (r > 59)
+  {
+    near_bits[k + 1] = (near_bits[k + 1] & ~(31ULL >> (64 - r))) | bits >> (64 - r);
+  }
+}
+
+// returns the five bytes `a[0]`, ..., `a[4]` packed into one word, byte `i` at bits `8 * i` to `8 * i + 7`
+static inline ullong load_row(const char *a)
+{
+  return (ullong)(unsigned char)a[0] | (ullong)(unsigned char)a[1] << 8 | (ullong)(unsigned char)a[2] << 16 | (ullong)(unsigned char)a[3] << 24 | (ullong)(unsigned char)a[4] << 32;
+}
+
+// returns a mask with bit `i` set if and only if byte `i` of the packed row `x` is non-zero. assumes that every byte is below 128
+static inline ullong nonzero_bytes(ullong x)
+{
+  // the high bit of each byte of the sum is set if and only if the byte is non-zero. the multiplication then moves the bit of byte `i` to bit `56 + i`, and no two of the other products meet
+  x = ((x + 0x7f7f7f7f7fULL) >> 7) & 0x0101010101ULL;
+  return (x * 0x0102040810000000ULL >> 56) & 31;
+}
+
+// the 5x5 subfield does not reach past the border, so each row of it is updated as a whole. as the counts are at most 25, adding or subtracting 1 from each byte of a packed row never carries over into the next byte
 static void update_nearby_full(int v, int d)
 {
-  int u, u0, i;
+  int u0, i;
+  ullong x;
   u0 = v + 2 * nw;
   for (i = 0; i < 5; i++)
   {
-    for (u = u0; u < u0 + 5; u++)
-    {
-      nearby[u] += d;
-    }
+    x = load_row(nearby + u0) + (d > 0 ? 0x0101010101ULL : -0x0101010101ULL);
+    nearby[u0] = (char)x;
+    nearby[u0 + 1] = (char)(x >> 8);
+    nearby[u0 + 2] = (char)(x >> 16);
+    nearby[u0 + 3] = (char)(x >> 24);
+    nearby[u0 + 4] = (char)(x >> 32);
+    set_near_row(u0, nonzero_bytes(x));
     u0 += w;
   }
 }
@@ -56,12 +114,12 @@ static void update_nearby_partial(int v_x, int v_y, int d)
   {
     for (x = x0; x < x1; x++)
     {
-      nearby[x + w * y] += d;
+      update_nearby_square(x + w * y, d);
     }
   }
 }
 
-// executes `nearby[s] += d` for each square `s` in the 5x5 subfield with center square `v`
+// executes `nearby[s] += d` for each square `s` in the 5x5 subfield with center square `v`. should be called right after a stone is placed on (`d == 1`) or removed from (`d == -1`) `v`, as it also updates the candidate moves (see bitboard.c)
 void update_nearby(int v, int d)
 {
   int x, y;
@@ -75,6 +133,32 @@ void update_nearby(int v, int d)
   {
     update_nearby_partial(x, y, d);
   }
+  occupied_bits[v >> 6] ^= 1ULL << (v & 63);
+}
+
+// recomputes the candidate moves from `board` and `nearby`. should be called after `board` or `nearby` is changed directly, as for a fragmented configuration of blocks, where every square is made nearby
+void reset_candidates()
+{
+  int v;
+  for (v = 0; v < size; v++)
+  {
+    if (nearby[v])
+    {
+      near_bits[v >> 6] |= 1ULL << (v & 63);
+    }
+    else
+    {
+      near_bits[v >> 6] &= ~(1ULL << (v & 63));
+    }
+    if (board[v])
+    {
+      occupied_bits[v >> 6] |= 1ULL << (v & 63);
+    }
+    else
+    {
+      occupied_bits[v >> 6] &= ~(1ULL << (v & 63));
+    }
+  }
 }
 
 static void add_four(Player *r, int v, int u)
@@ -129,29 +213,81 @@ static void fl_remove(Player *r, int v)
   }
 }
 
+void actions_ini(ActionList *list)
+{
+  list->size = 99;
+  list->length = 0;
+  list->values = (Action *)malloc_safe(list->size * sizeof(Action));
+}
+
+void actions_cleanup(ActionList *list)
+{
+  free(list->values);
+}
+
+// adds an action to the current turn
+static void add_action(char type, int v, int u)
+{
+  Action *a;
+  if (actions.length == actions.size)
+  {
+    actions.size *= 2;
+    actions.values = (Action *)realloc_safe(actions.values, actions.size * sizeof(Action));
+  }
+  a = &actions.values[actions.length++];
+  a->type = type;
+  a->turn = turn;
+  a->v = v;
+  a->u = u;
+}
+
 static void create_four(int v, int u)
 {
   if (!list_contains(&p->fours[v], u))
   {
     add_four(p, v, u);
     add_four(p, u, v);
-    list_add(&actions, u);
-    list_add(&actions, v);
-    list_add(&actions, action_create_four);
-    list_add(&actions, turn);
+    add_action(action_create_four, v, u);
     fl_add(p, min_(u, v));
   }
 }
 
+// looks at the `m` squares that follow the empty square `v` in the direction `s * d`, where `d` is one of the four directions of the lines and `i` is the index of the bit of `v` on its line in direction `d`. adds to `*y` the number of `pid` stones directly after `v` (at most `m`)
+// returns the empty square `u` among these squares such that the other squares all contain a `pid` stone, or 0 if no such square exists. in that case `v` and `u` complete a row of `pid` stones
+static int find_four_end(int v, int i, int d, int s, int m, int *y)
+{
+  int a, b, u;
+  ullong *bits;
+  bits = player_bits(pid);
+  a = s > 0 ? run_up(bits, i + 1) : run_down(bits, i - 1);
+  if (a >= m)
+  {
+    *y += m;
+    return 0;
+  }
+  *y += a;
+  u = v + s * (a + 1) * d;
+  if (board[u])
+  {
+    return 0;
+  }
+  i += s * (a + 1);
+  b = s > 0 ? run_up(bits, i + 1) : run_down(bits, i - 1);
+  return a + 1 + b >= m ? u : 0;
+}
+
 static void create_fours(int v)
 {
-  int dir, j, a, b, x, y, left, right, left2, right2, u, d;
+  int dir, a, b, x, y, i, left, right, left2, right2, d;
   int dirs[4] = { 1, w, 1 + w, 1 - w };
+  ullong *bits;
+  bits = player_bits(pid);
   for (dir = 0; dir < 4; dir++)
   {
     d = dirs[dir];
-    a = tail_length(v, d, pid);
-    b = tail_length(v, -d, pid);
+    i = bit_index[4 * v + dir];
+    a = run_up(bits, i + 1);
+    b = run_down(bits, i - 1);
     x = 1 + a + b;
     if (x > n - 2)
     {
@@ -162,70 +298,16 @@ static void create_fours(int v)
     y = 0; // will eventually contain the number of `pid` stones directly to the right of `right` and to the left of `left`, when `left` and `right` are empty
     if (!board[right])
     {
-      right2 = 0; // when non-zero then `right2` is empty and only `pid` stones lie between `right` and `right2`
-      u = right + d;
-      for (j = x + 1; j < n; j++)
-      {
-        if (!board[u])
-        {
-          if (right2)
-          {
-            break;
-          }
-          else
-          {
-            right2 = u;
-          }
-        }
-        else if (board[u] == pid)
-        {
-          if (!right2)
-          {
-            y++;
-          }
-        }
-        else
-        {
-          break;
-        }
-        u += d;
-      }
-      if (j == n && right2)
+      right2 = find_four_end(right, i + a + 1, d, 1, n - 1 - x, &y);
+      if (right2)
       {
         create_four(right, right2);
       }
     }
     if (!board[left])
     {
-      left2 = 0;
-      u = left - d;
-      for (j = x + 1; j < n; j++)
-      {
-        if (!board[u])
-        {
-          if (left2)
-          {
-            break;
-          }
-          else
-          {
-            left2 = u;
-          }
-        }
-        else if (board[u] == pid)
-        {
-          if (!left2)
-          {
-            y++;
-          }
-        }
-        else
-        {
-          break;
-        }
-        u -= d;
-      }
-      if (j == n && left2)
+      left2 = find_four_end(left, i - b - 1, d, -1, n - 1 - x, &y);
+      if (left2)
       {
         create_four(left, left2);
       }
@@ -323,8 +405,7 @@ static void revert_threats(int v)
 static void set_winner(char id)
 {
   winner = id;
-  list_add(&actions, action_set_winner);
-  list_add(&actions, turn);
+  add_action(action_set_winner, 0, 0);
 }
 
 // places a stone on the board for the current player and gives the turn to the other player
@@ -343,10 +424,11 @@ void submit_move(int v)
   }
   if (track_board_value)
   {
-    board_values[turn] = board_value;
     update_board_value(v, pid);
   }
   board[v] = pid;
+  bitboard_flip(v, pid);
+  hash ^= zobrist[4 * v + pid];
   empty_squares--;
   if (!winner)
   {
@@ -383,20 +465,17 @@ void submit_moves(int k, int *ar)
 // reverts all actions done in the current turn
 static void revert_actions()
 {
-  int u, v, action;
-  while (actions.length && list_peak(&actions) == turn)
+  Action *a;
+  while (actions.length && actions.values[actions.length - 1].turn == turn)
   {
-    actions.length--;
-    action = list_pop(&actions);
-    if (action == action_create_four)
+    a = &actions.values[--actions.length];
+    if (a->type == action_create_four)
     {
-      v = list_pop(&actions);
-      u = list_pop(&actions);
-      remove_four(p, v, u);
-      remove_four(p, u, v);
-      fl_remove(p, min_(u, v));
+      remove_four(p, a->v, a->u);
+      remove_four(p, a->u, a->v);
+      fl_remove(p, min_(a->u, a->v));
     }
-    else if (action == action_set_winner)
+    else if (a->type == action_set_winner)
     {
       winner = 0;
     }
@@ -418,8 +497,9 @@ void undo_move()
   if (track_board_value)
   {
     revert_board_value(v);
-    board_value = board_values[turn];
   }
+  hash ^= zobrist[4 * v + board[v]];
+  bitboard_flip(v, board[v]);
   board[v] = 0;
   update_nearby(v, -1);
   revert_threats(v);
@@ -436,6 +516,35 @@ void undo_moves(int k)
   }
 }
 
+// brings the game to the position after the moves `history[0]`, ..., `history[length - 1]` (in the format of `moves`), which start from the same initial position as the game of the calling thread. only the moves after the common part of both histories are undone and made again, so a thread can cheaply follow the game of another thread
+void board_follow(const int *history, int length)
+{
+  int k;
+  k = 0;
+  while (k < turn && k < length && moves[k] == history[k])
+  {
+    k++;
+  }
+  undo_moves(turn - k);
+  while (turn < length)
+  {
+    set_p(history[turn] > 0 ? 1 : 2);
+    submit_move(abs(history[turn]));
+  }
+}
+
+// places a stone of player `id` (or a block if `id == 3`) on the empty square `v` without adding a move to the history. used to set up the initial position
+void place_stone(int v, char id)
+{
+  // the lines do not account for stones placed outside of `submit_move`
+  stop_tracking_board_value();
+  board[v] = id;
+  bitboard_flip(v, id);
+  occupied_bits[v >> 6] |= 1ULL << (v & 63);
+  hash ^= zobrist[4 * v + id];
+  empty_squares--;
+}
+
 // returns a random empty square, or 0 if no such square exists
 int random_empty_square()
 {
@@ -467,12 +576,9 @@ int random_empty_nearby_square()
   int v;
   List list;
   list_ini(&list, empty_squares);
-  for (v = v0; v < v1; v++)
+  for (v = first_candidate(); v; v = next_candidate(v))
   {
-    if (!board[v] && nearby[v])
-    {
-      list_add(&list, v);
-    }
+    list_add(&list, v);
   }
   if (list.length)
   {
@@ -511,6 +617,10 @@ char set_p(char id)
 {
   char pid_before;
   pid_before = pid;
+  if ((pid == 2) != (id == 2))
+  {
+    hash ^= zobrist_side;
+  }
   pid = id;
   qid = 3 - id;
   p = &players[id - 1];
@@ -518,34 +628,29 @@ char set_p(char id)
   return pid_before;
 }
 
-int *copy_moves()
+// returns a checkpoint of the current state of the game, to be used with `board_rollback`
+int board_mark()
 {
-  int *backup, i;
-  backup = (int *)malloc_safe(sizeof(int) * (turn + 1));
-  backup[0] = turn;
-  for (i = 0; i < turn; i++)
-  {
-    backup[i + 1] = moves[i];
-  }
-  return backup;
+  return turn;
 }
 
-void restore_moves(int *backup)
+// reverts the game to the state of checkpoint `mark`, by undoing the moves made since then. the undone moves remain available to `board_redo` until a new move is made
+void board_rollback(int mark)
 {
-  int backup_turn, i;
-  backup_turn = backup[0];
-  for (i = 0; i < min_(turn, backup_turn); i++)
+  if (sanity_checks && mark > turn)
   {
-    if (backup[i + 1] != moves[i])
-    {
-      break;
-    }
+    fail_("board_rollback: checkpoint %d lies after turn %d", mark, turn);
   }
-  undo_moves(turn - i);
-  for (; i < backup_turn; i++)
+  undo_moves(turn - mark);
+}
+
+// makes again the moves that were undone by `board_rollback`, until the state of checkpoint `mark` is reached
+void board_redo(int mark)
+{
+  while (turn < mark)
   {
-    set_p(backup[i + 1] > 0 ? 1 : 2);
-    submit_move(abs(backup[i + 1]));
+    set_p(moves[turn] > 0 ? 1 : 2);
+    submit_move(abs(moves[turn]));
   }
 }
 
@@ -561,3 +666,176 @@ int win_within_3()
 {
   return p->fives.length || q->fives.length >= 2 || win_in_3(pid);
 }
+
+// sets `*dest` to a deep copy of `*src`, apart from the threat space search results
+static void copy_player(Player *dest, Player *src)
+{
+  int v;
+  *dest = *src;
+  dest->scores = (float *)malloc_safe(size * sizeof(float));
+  memcpy(dest->scores, src->scores, size * sizeof(float));
+  dest->fours = (List *)calloc_safe(size, sizeof(List));
+  for (v = 0; v < size; v++)
+  {
+    if (src->fours[v].length)
+    {
+      list_ini(&dest->fours[v], src->fours[v].length);
+      memcpy(dest->fours[v].values, src->fours[v].values, src->fours[v].length * sizeof(int));
+      dest->fours[v].length = src->fours[v].length;
+    }
+  }
+  dest->five_count = (char *)malloc_safe(size * sizeof(char));
+  memcpy(dest->five_count, src->five_count, size * sizeof(char));
+  dest->fl_count = (char *)malloc_safe(size * sizeof(char));
+  memcpy(dest->fl_count, src->fl_count, size * sizeof(char));
+  list_ini(&dest->fives, src->fives.length + 9);
+  list_ini(&dest->double_fours, src->double_fours.length + 9);
+  list_ini(&dest->fl, src->fl.length + 9);
+  for (v = 0; v < src->fives.length; v++)
+  {
+    list_add(&dest->fives, src->fives.values[v]);
+  }
+  for (v = 0; v < src->double_fours.length; v++)
+  {
+    list_add(&dest->double_fours, src->double_fours.values[v]);
+  }
+  for (v = 0; v < src->fl.length; v++)
+  {
+    list_add(&dest->fl, src->fl.values[v]);
+  }
+  dest->result.threats = 0;
+}
+
+static void free_player(Player *r)
+{
+  int v;
+  for (v = 0; v < size; v++)
+  {
+    list_cleanup(&r->fours[v]);
+  }
+  free(r->scores);
+  free(r->fours);
+  free(r->five_count);
+  free(r->fl_count);
+  list_cleanup(&r->fives);
+  list_cleanup(&r->double_fours);
+  list_cleanup(&r->fl);
+}
+
+// stores in `e` a copy of the state of the game of the calling thread, including the history of the game, so the copy can also undo the moves made before the copy (as with `board_rollback`). only `win_board`, which the threat space search fills anew for every sequence, starts out empty
+void engine_copy(Engine *e)
+{
+  int k;
+  e->board = (char *)malloc_safe(size * sizeof(char));
+  memcpy(e->board, board, size * sizeof(char));
+  e->nearby = (char *)malloc_safe(size * sizeof(char));
+  memcpy(e->nearby, nearby, size * sizeof(char));
+  e->line_bits = (ullong *)malloc_safe(line_bits_size * sizeof(ullong));
+  memcpy(e->line_bits, line_bits, line_bits_size * sizeof(ullong));
+  e->near_bits = (ullong *)malloc_safe(candidate_words * sizeof(ullong));
+  memcpy(e->near_bits, near_bits, candidate_words * sizeof(ullong));
+  e->occupied_bits = (ullong *)malloc_safe(candidate_words * sizeof(ullong));
+  memcpy(e->occupied_bits, occupied_bits, candidate_words * sizeof(ullong));
+  e->moves = (int *)malloc_safe(size * sizeof(int));
+  memcpy(e->moves, moves, turn * sizeof(int));
+  e->turn = turn;
+  e->empty_squares = empty_squares;
+  e->winner = winner;
+  e->pid = pid;
+  e->active_id = active_id;
+  e->active_turn = active_turn;
+  e->hash = hash;
+  e->actions.size = actions.size;
+  e->actions.length = actions.length;
+  e->actions.values = (Action *)malloc_safe(actions.size * sizeof(Action));
+  memcpy(e->actions.values, actions.values, actions.length * sizeof(Action));
+  for (k = 0; k < 2; k++)
+  {
+    copy_player(&e->players[k], &players[k]);
+  }
+  e->win_board = (char *)calloc_safe(size, sizeof(char));
+}
+
+// continues the game stored in `e` on the calling thread
+void engine_load(Engine *e)
+{
+  int k;
+  board = e->board;
+  nearby = e->nearby;
+  line_bits = e->line_bits;
+  near_bits = e->near_bits;
+  occupied_bits = e->occupied_bits;
+  moves = e->moves;
+  turn = e->turn;
+  empty_squares = e->empty_squares;
+  winner = e->winner;
+  actions = e->actions;
+  for (k = 0; k < 2; k++)
+  {
+    players[k] = e->players[k];
+  }
+  pid = 0;
+  set_p(e->pid);
+  hash = e->hash;
+  active_id = e->active_id;
+  active_turn = e->active_turn;
+  active_player = active_id ? &players[active_id - 1] : 0;
+  win_board = e->win_board;
+}
+
+// stores the state of the game of the calling thread in `e`
+void engine_save(Engine *e)
+{
+  int k;
+  e->board = board;
+  e->nearby = nearby;
+  e->line_bits = line_bits;
+  e->near_bits = near_bits;
+  e->occupied_bits = occupied_bits;
+  e->moves = moves;
+  e->turn = turn;
+  e->empty_squares = empty_squares;
+  e->winner = winner;
+  e->pid = pid;
+  e->active_id = active_id;
+  e->active_turn = active_turn;
+  e->hash = hash;
+  e->actions = actions;
+  for (k = 0; k < 2; k++)
+  {
+    e->players[k] = players[k];
+  }
+  e->win_board = win_board;
+}
+
+void engine_free(Engine *e)
+{
+  int k;
+  free(e->board);
+  free(e->nearby);
+  free(e->line_bits);
+  free(e->near_bits);
+  free(e->occupied_bits);
+  free(e->moves);
+  actions_cleanup(&e->actions);
+  for (k = 0; k < 2; k++)
+  {
+    free_player(&e->players[k]);
+  }
+  free(e->win_board);
+}
+
+// allocates the state that the modules keep for every thread. must be called by a thread before it runs a search on a loaded engine
+void engine_thread_ini()
+{
+  file_line_heur_thread_ini();
+  file_tss_fours_thread_ini();
+  file_tss_thread_ini();
+}
+
+void engine_thread_cleanup()
+{
+  file_line_heur_thread_cleanup();
+  file_tss_fours_thread_cleanup();
+  file_tss_thread_cleanup();
+}
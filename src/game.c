@@ -6,38 +6,46 @@ int size;  // `size = w * h`
 int v0, v1;
 int se, ne, sw, nw;
 
-char *board;  // the playing field. an array of length `size`. we picture the indices 0, w-1, and size-1 as respectivly the top-left, top-right and bottom-right corners of the playing field
-char pid;  // id of the player to move (equal to 1 or 2)
-char qid;
-char winner;  // id of the winner, or `draw` for a draw. a value of 0 indicates that the game is still running
-int empty_squares;  // number of empty squares
-int turn;  // number of the current turn, starting at zero
-int *moves;  // history of all moves in chronological order (an array of length `turn`)
-char *nearby;  // `nearby[v]` equals the number of stones in the 5x5 subfield with center `v`
+thread_local_ char *board;  // the playing field. an array of length `size`. we picture the indices 0, w-1, and size-1 as respectivly the top-left, top-right and bottom-right corners of the playing field
+thread_local_ char pid;  // id of the player to move (equal to 1 or 2)
+thread_local_ char qid;
+thread_local_ char winner;  // id of the winner, or `draw` for a draw. a value of 0 indicates that the game is still running
+thread_local_ int empty_squares;  // number of empty squares
+thread_local_ int turn;  // number of the current turn, starting at zero
+thread_local_ int *moves;  // history of all moves in chronological order (an array of length `turn`)
+thread_local_ char *nearby;  // `nearby[v]` equals the number of stones in the 5x5 subfield with center `v`
+thread_local_ ullong hash;  // zobrist key of the current position. covers the stones, the blocks and the player to move
+ullong *zobrist;  // `zobrist[4 * v + id]` is the key of a stone of player `id` (or a block if `id == 3`) on square `v`
+ullong zobrist_side;  // part of `hash` if and only if player 2 is to move
 
 char black_id;  // id of the black player
 char white_id;  // id of the white player
-Player players[2];  // the two players
-Player *p; // the player corresponding to `pid`
-Player *q; // the player corresponding to `3 - pid`
-Player *active_player;  // the player who tries to compute his next move
-char active_id;  // id of `active_player`. in general different from `pid` (as every ai may temporarily change the state of the board)
-int active_turn; // the number of the turn of `active_player`
+thread_local_ Player players[2];  // the two players
+thread_local_ Player *p; // the player corresponding to `pid`
+thread_local_ Player *q; // the player corresponding to `3 - pid`
+thread_local_ Player *active_player;  // the player who tries to compute his next move
+thread_local_ char active_id;  // id of `active_player`. in general different from `pid` (as every ai may temporarily change the state of the board)
+thread_local_ int active_turn; // the number of the turn of `active_player`
 int games_played; // the number of finished games
-float start_of_turn;  // time stamp of start of turn
-float end_of_turn;  // time stamp before turn should end
-float stop_time;  // time stamp of end of time limit (as set by `set_time_limit`)
-int out_of_time;  // whether we ran out of time at a call to `check_out_of_time`
-char *conflict_board;  // used by threat space search to detect conflicting threats
-char *win_board;  // used by threat space search in the detection of counter four-threat sequences
+thread_local_ float start_of_turn;  // time stamp of start of turn
+thread_local_ float end_of_turn;  // time stamp before turn should end. the searches divide the time until then among themselves
+thread_local_ float max_end_of_turn;  // time stamp before the turn must end. `end_of_turn` may be moved up to this point by `extend_turn`
+float timeout_match;  // the time limit (in seconds) of the whole match, as set by the manager in brain mode, or 0 if there is none
+float match_time_left;  // the remaining time (in seconds) of the whole match, as last reported by the manager in brain mode
+thread_local_ float stop_time;  // time stamp of end of time limit (as set by `set_time_limit`). the hard deadline: the search stops as soon as it is passed
+thread_local_ float soft_stop_time;  // time stamp after which no new iteration of a search should be started (as set by `set_soft_deadline`). the soft deadline
+float max_overshoot = -FLT_MAX;  // the largest amount of time by which an ai exceeded the time limit of its turn
+thread_local_ int out_of_time;  // whether we ran out of time at a call to `check_out_of_time`
+thread_local_ char *win_board;  // used by threat space search in the detection of counter four-threat sequences
+thread_local_ ullong win_board_key;  // the zobrist key of the squares of `win_board`
 int playback_arg;
 int(*default_ai)();
 int exit_now;  // if set then we are exiting the program
-int first_print;
+thread_local_ int first_print;
 int print_every_board;
-TssResult result;
-int found_wts;
-List actions;
+thread_local_ TssResult result;
+thread_local_ int found_wts;
+thread_local_ ActionList actions;  // the changes made by the moves to the threat lists and the winner, such that `undo_move` can revert them
 
 int slightly_verbose;  // slightly verbose logging
 int verbose;  // verbose logging
@@ -57,6 +65,8 @@ int sanity_checks;  // if set then we run a number of sanity checks during execu
 int auto_start;  // if set then we automatically start a new game when a game has ended
 int initial_seed;
 int human_supervisor;
+int threads;  // number of threads used by the alpha-beta search, by the combination stages of the threat space search and by the search for a safe move
+int ponder;  // whether the ai searches on the time of the opponent, when the opponent is a human or the manager in brain mode
 
 static int playback_active;
 static void start_brain_loop();
@@ -70,9 +80,10 @@ void initialize_globals()
   size = w * h;
   board = (char *)calloc_safe(size, sizeof(char));
   nearby = (char *)calloc_safe(size, sizeof(char));
-  conflict_board = (char *)calloc_safe(size, sizeof(char));
   win_board = (char *)calloc_safe(size, sizeof(char));
   moves = (int *)malloc_safe(size * sizeof(int));
+  zobrist = (ullong *)malloc_safe(4 * size * sizeof(ullong));
+  zobrist_ini();
   winner = 0;
   turn = 0;
   if (!games_played)
@@ -91,7 +102,7 @@ void initialize_globals()
   v0 = se;
   v1 = size + nw;
   empty_squares = (w - 2) * (h - 2);
-  list_ini(&actions, 99);
+  actions_ini(&actions);
   for (k = 0; k < w; k++)
   {
     board[k] = 3;
@@ -114,9 +125,12 @@ void initialize_globals()
     r->fl_count = (char *)calloc_safe(size, sizeof(char));
     r->next_threat = 0;
   }
+  file_bitboard_ini();
   file_line_heur_ini();
+  file_alpha_beta_ini();
   file_tss_fours_ini();
   file_tss_ini();
+  file_tss_cache_ini();
   if (!games_played)
   {
     if (initial_seed == -1)
@@ -139,12 +153,13 @@ void free_globals()
 {
   int k, i;
   Player *r;
+  stop_pondering(0);
   free(board);
   free(nearby);
-  free(conflict_board);
   free(win_board);
   free(moves);
-  list_cleanup(&actions);
+  free(zobrist);
+  actions_cleanup(&actions);
   for (k = 0; k < 2; k++)
   {
     r = &players[k];
@@ -162,9 +177,12 @@ void free_globals()
     free(r->result.threats);
     r->result.threats = 0;
   }
+  file_bitboard_cleanup();
   file_line_heur_cleanup();
+  file_alpha_beta_cleanup();
   file_tss_fours_cleanup();
   file_tss_cleanup();
+  file_tss_cache_cleanup();
 }
 
 // executes a single turn
@@ -182,10 +200,13 @@ static void play_one_turn()
   if (!playback_active || (human_supervisor && p->get_next_move != human))
   {
     active_turn = turn;
-    start_of_turn = get_time();
-    end_of_turn = start_of_turn + p->time_limit;
+    allocate_turn_time();
     get_elapsed_time();
     v = p->get_next_move();
+    if (p->get_next_move != human)
+    {
+      record_overshoot();
+    }
     if (human_supervisor)
     {
       print_("move = (%d, %d)", v % w - 1, v / w - 1);
@@ -212,6 +233,8 @@ static void play_one_turn()
       print_("move = (%d, %d)", v % w - 1, v / w - 1);
     }
   }
+  // a move of a human opponent ends the pondering, which hands its results over to the next turn if it predicted `v`. in brain mode this happens when "TURN" arrives
+  stop_pondering(v);
   if (!first_print)
   {
     printf("\n");
@@ -225,6 +248,10 @@ static void play_one_turn()
     return;
   }
   submit_move(v);
+  if (ponder && !brain && !winner && active_player->get_next_move != human && p->get_next_move == human)
+  {
+    start_pondering();
+  }
   if (show_board)
   {
     if (ultra_verbose)
@@ -326,6 +353,10 @@ void run_game()
     }
   }
   printf("\n");
+  if (ultra_verbose && max_overshoot > -FLT_MAX)
+  {
+    printf("the ai finished its turn at most %.3f sec after the time limit (a negative value means before)\n", max_overshoot);
+  }
   if (slightly_verbose || show_board)
   {
     print_game_state(stdout);
@@ -353,6 +384,48 @@ static void get_next_move()
   play_one_turn();
   v = moves[turn - 1];
   printf("%d,%d\n", v % w - 1, v / w - 1);
+  if (ponder)
+  {
+    start_pondering();
+  }
+}
+
+// handles the message "INFO `key` `value`" of the manager in brain mode
+static void read_info(char *key)
+{
+  char *value;
+  int max_tt_size;
+  value = strchr(key, ' ');
+  if (!value)
+  {
+    return;
+  }
+  value++;
+  if (strstr(key, "timeout_turn") == key)
+  {
+    players[0].time_limit = (float)atoi(value) / 1000;
+  }
+  else if (strstr(key, "timeout_match") == key)
+  {
+    timeout_match = (float)atoi(value) / 1000;
+    match_time_left = timeout_match;
+  }
+  else if (strstr(key, "time_left") == key)
+  {
+    match_time_left = (float)atoi(value) / 1000;
+  }
+  else if (strstr(key, "max_memory") == key && atoi(value) > 0)
+  {
+    // the transposition table may use a third of the memory
+    max_tt_size = atoi(value) / 3 >> 20;
+    if (tt_size > max_tt_size)
+    {
+      stop_pondering(0);
+      tt_size = max_tt_size;
+      file_alpha_beta_cleanup();
+      file_alpha_beta_ini();
+    }
+  }
 }
 
 static void start_brain_loop()
@@ -365,6 +438,16 @@ static void start_brain_loop()
     {
       fail_("`fgets` returned zero");
     }
+    x = 0;
+    if (strstr(buf, "TURN") == buf)
+    {
+      x = 1 + atoi(buf + 5) + w * (1 + atoi(&strstr(buf, ",")[1]));
+    }
+    // the manager only sends "INFO" messages in between a move of the ai and the move of the opponent that the ai may have predicted. any other message ends the pondering, which hands its results over to the next turn if the message is the predicted move
+    if (strstr(buf, "INFO") != buf)
+    {
+      stop_pondering(x);
+    }
     if (strstr(buf, "START") == buf)
     {
       w = atoi(buf + 6) + 2;
@@ -374,10 +457,7 @@ static void start_brain_loop()
     }
     else if (strstr(buf, "INFO") == buf)
     {
-      if (strstr(buf + 5, "timeout_turn"))
-      {
-        players[0].time_limit = (float)atoi(buf + 18) / 1000;
-      }
+      read_info(buf + 5);
     }
     else if (strstr(buf, "TAKEBACK") == buf)
     {
@@ -388,7 +468,7 @@ static void start_brain_loop()
       if (strstr(buf, "TURN") == buf)
       {
         set_p(2);
-        submit_move(1 + atoi(buf + 5) + w * (1 + atoi(&strstr(buf, ",")[1])));
+        submit_move(x);
       }
       get_next_move();
     }
@@ -11,7 +11,7 @@ static int is_quit_message(char *line)
 // assumes that the turns alternate between black and white
 void print_game_state(FILE *stream)
 {
-  int k, first, v, i, j, *backup;
+  int k, first, v, i, j, mark;
   fprintf(stream, "-w %d", w - 2);
   if (w != h)
   {
@@ -27,8 +27,8 @@ void print_game_state(FILE *stream)
   }
   if (empty_squares != (w - 2) * (h - 2) - turn)
   {
-    backup = copy_moves();
-    undo_moves(turn);
+    mark = board_mark();
+    board_rollback(0);
     for (k = 1; k <= 3; k++)
     {
       first = 1;
@@ -51,8 +51,7 @@ void print_game_state(FILE *stream)
         v += 2;
       }
     }
-    restore_moves(backup);
-    free(backup);
+    board_redo(mark);
   }
   if (turn)
   {
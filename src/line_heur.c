@@ -23,10 +23,19 @@
 #define south_id 1
 #define se_id 2
 #define ne_id 3
+#define max_table_segment 15  // the longest segment of which `get_board_scores` looks up the score in `segment_scores`
+#define parallel_fill_masks 100000  // `scores` is filled by `threads` threads if it has at least this many masks
+
+// a thread that fills the part of `scores` from mask `from` up to (but not including) mask `to`
+typedef struct ScoreFiller
+{
+  Thread thread;
+  int from, to;
+} ScoreFiller;
 
 typedef struct Line
 {
-  int *mask;
+  int *mask;  // the mask of the segment, which points into `masks`
   int value;
   int v;
   char length;
@@ -34,60 +43,82 @@ typedef struct Line
 
 int max_mask_length;
 static int *three_power;
-static Line *lines;
+static thread_local_ Line *lines;
+static thread_local_ char *segment;  // a copy of the part of a line that `get_segment_delta` evaluates
+static thread_local_ int *masks;  // the arena from which `setup_line` allocates the masks of the segments. as a segment contains at least n squares, there are at most `nlines / n` masks
+static thread_local_ int mask_count;
 static int nlines;
-static float *scores;
-static int nscores;
-static float multipliers[3];
-int track_board_value;
-float board_value;
-float *board_values;
+static unsigned short *scores;  // `scores[mask]` is player 1's score of a segment with mask `mask`. the table is shared by all threads and kept for all games, as it only depends on `n` and `max_mask_length`
+static unsigned short *segment_scores;  // `segment_scores[(1 << length) | bits]` is player 1's score of a segment of `length` squares without stones of player 2, on which bit `i` of `bits` is set if and only if square `i` contains a stone of player 1
+static int scores_n;  // the value of `n` for which `scores` and `segment_scores` were allocated
+static int scores_mask_length;  // the value of `max_mask_length` for which `scores` was allocated
+thread_local_ int track_board_value;  // whether `lines` and `board_scores` describe the current board. if set then `submit_move` and `undo_move` keep them up to date
+static thread_local_ int lines_kept;  // whether `lines` and `board_scores` describe the position at which the tracking last stopped, which is the position after the first `lines_turn` moves of the game, with key `lines_hash`
+static thread_local_ int lines_turn;
+static thread_local_ ullong lines_hash;
+static thread_local_ int board_scores[3];  // `board_scores[id]` is player `id`'s score of the board
+static thread_local_ int *board_score_history;  // the values of `board_scores[1]` and `board_scores[2]` before each move, which are restored when the move is undone
+static thread_local_ uint noise;  // the state of the generator of the tie-break noise of `line_heur`
 
-static void initialize_scores();
+static void fill_score_tables();
 
 void file_line_heur_ini()
 {
   int a, i;
-  three_power = (int *)malloc_safe(sizeof(int) * (max_mask_length + 1));
-  a = 1;
-  for (i = 0; i <= max_mask_length; i++)
+  if (!scores || scores_n != n || scores_mask_length != max_mask_length)
   {
-    three_power[i] = a;
-    a *= 3;
+    free(scores);
+    free(segment_scores);
+    free(three_power);
+    three_power = (int *)malloc_safe(sizeof(int) * (max_mask_length + 1));
+    a = 1;
+    for (i = 0; i <= max_mask_length; i++)
+    {
+      three_power[i] = a;
+      a *= 3;
+    }
+    scores = (unsigned short *)malloc_safe(three_power[max_mask_length] * sizeof(unsigned short));
+    segment_scores = (unsigned short *)malloc_safe((2 << max_table_segment) * sizeof(unsigned short));
+    scores_n = n;
+    scores_mask_length = max_mask_length;
+    // the tables are shared by the threads, so they are filled before any thread reads them
+    fill_score_tables();
   }
-  initialize_scores();
   nlines = size * 8;
-  lines = (Line *)malloc_safe(nlines * sizeof(Line));
-  board_values = (float *)malloc_safe(sizeof(float) * size);
+  file_line_heur_thread_ini();
 }
 
 void file_line_heur_cleanup()
 {
-  free(lines);
-  free(scores);
-  free(three_power);
-  free(board_values);
+  file_line_heur_thread_cleanup();
 }
 
-static int get_line_index(int v, int id, int id_d)
+// allocates the data structures that every thread needs for tracking the board value
+void file_line_heur_thread_ini()
 {
-  return v * 8 + (id - 1) * 4 + id_d;
+  lines = (Line *)malloc_safe(nlines * sizeof(Line));
+  segment = (char *)malloc_safe(sizeof(char) * max_(w, h));
+  masks = (int *)malloc_safe(sizeof(int) * (nlines / n + 1));
+  board_score_history = (int *)malloc_safe(sizeof(int) * 2 * size);
+  track_board_value = 0;
+  lines_kept = 0;
 }
 
-static void free_masks()
+void file_line_heur_thread_cleanup()
 {
-  int i;
-  for (i = 0; i < nlines; i++)
-  {
-    if (lines[i].value == 1)
-    {
-      free(lines[i].mask);
-    }
-  }
+  free(lines);
+  free(segment);
+  free(masks);
+  free(board_score_history);
+}
+
+static int get_line_index(int v, int id, int id_d)
+{
+  return v * 8 + (id - 1) * 4 + id_d;
 }
 
 // returns the score of an opportunity of length `length` containing `stones` stones
-static float get_opportunity_score(int stones, int length)
+static int get_opportunity_score(int stones, int length)
 {
   switch (n)
   {
@@ -166,21 +197,21 @@ static float get_opportunity_score(int stones, int length)
   }
 }
 
-// returns player `id`'s score of the line of length `length` starting with the indices `v`, `v + d`, `v + d + d`, ...
-static float get_line_score(int v, int d, int length, int id)
+// returns player `id`'s score of the line of length `length` consisting of the squares `s[0]`, `s[d]`, `s[d + d]`, ...
+static int get_line_score(const char *s, int d, int length, int id)
 {
   int k, l, m, x, y;
   int next_k;
   int next_min_start;
-  float ans;
-  float score;
+  int ans;
+  int score;
   int start;  // index of the start square of the current opportunity
   int end;  // index of the last square of the current opportunity
   int last_stone;  // index of the last stone in the current opportunity
   int stones;  // number of stones in the current opportunity
   int last_end;  // index of the last square of the last opportunity
   int min_start;  // lower bound on start (for example because on position `min_start - 1` there lies a white stone)
-  float last_score;  // score of the last opportunity. not yet added to `ans`
+  int last_score;  // score of the last opportunity. not yet added to `ans`
   ans = 0;
   last_end = -1;
   last_score = 0;
@@ -188,7 +219,7 @@ static float get_line_score(int v, int d, int length, int id)
   k = 0;
   while (k < length)
   {
-    x = board[v + d * k];
+    x = s[d * k];
     if (x == id)
     {
       stones = 1;
@@ -197,7 +228,7 @@ static float get_line_score(int v, int d, int length, int id)
       m = min_(length, k + n);
       for (l = k + 1; l < m; l++)
       {
-        y = board[v + d * l];
+        y = s[d * l];
         if (y == id)
         {
           stones++;
@@ -257,49 +288,107 @@ static float get_line_score(int v, int d, int length, int id)
   return ans + last_score;
 }
 
-// returns player `id`'s score of the board
-static float get_board_score(int id)
+// adds the scores of both players of the line of `length` squares that starts at square `v` and continues in the direction `d`, which has index `dir`, to `ans[1]` and `ans[2]`
+// the line is read from `line_bits` as a single word per player, and split into the segments between the stones of the opponent and the blocks. the score of a segment of at most `max_table_segment` squares is looked up by its stones in `segment_scores`, so only the longer segments are scanned square by square
+static void add_line_scores(int v, int d, int dir, int length, int *ans)
 {
-  int x, y;
-  float ans;
-  ans = 0;
-  for (y = 1; y < h - 1; y++)
+  int id, i, start, len;
+  ullong all, own, free_bits, segment_bits;
+  if (length < n)
+  {
+    return;
+  }
+  if (line_words > 1)
   {
-    ans += get_line_score(y * w + 1, 1, w - 2, id);
-    if (y < h - n)
+    ans[1] += get_line_score(board + v, d, length, 1);
+    ans[2] += get_line_score(board + v, d, length, 2);
+    return;
+  }
+  i = bit_index[4 * v + dir];
+  all = (1ULL << length) - 1;
+  for (id = 1; id <= 2; id++)
+  {
+    own = player_bits((char)id)[i >> 6] >> (i & 63) & all;
+    if (!own)
+    {
+      continue;
+    }
+    free_bits = ~((player_bits((char)(3 - id))[i >> 6] | player_bits(3)[i >> 6]) >> (i & 63)) & all;
+    while (free_bits)
     {
-      ans += get_line_score(y * w + 1, se, min_(w - 2, h - y - 1), id);
-      ans += get_line_score(w - 2 + y * w, sw, min_(w - 2, h - y - 1), id);
+      start = ctz64(free_bits);
+      len = ctz64(~(free_bits >> start));
+      segment_bits = own >> start & ((1ULL << len) - 1);
+      if (segment_bits && len >= n)
+      {
+        ans[id] += len <= max_table_segment ? segment_scores[1 << len | (int)segment_bits] : get_line_score(board + v + d * start, d, len, id);
+      }
+      // removes the lowest run of set bits
+      free_bits &= free_bits + (free_bits & (0 - free_bits));
     }
   }
+}
+
+// sets `ans[id]` to player `id`'s score of the board, for both players. this evaluates the whole board without the tracked lines
+static void get_board_scores(int *ans)
+{
+  int x, y;
+  ans[1] = 0;
+  ans[2] = 0;
+  for (y = 1; y < h - 1; y++)
+  {
+    add_line_scores(1 + w * y, 1, 0, w - 2, ans);
+    add_line_scores(1 + w * y, se, 2, min_(w - 2, h - y - 1), ans);
+    add_line_scores(1 + w * y, ne, 3, min_(w - 2, y), ans);
+  }
   for (x = 1; x < w - 1; x++)
   {
-    ans += get_line_score(x + w, w, h - 2, id);
-    if (x > 1 && x < w - n)
-    {
-      ans += get_line_score(x + w, se, min_(h - 2, w - x - 1), id);
-    }
-    if (x < w - 2 && x > n - 1)
+    add_line_scores(x + w, w, 1, h - 2, ans);
+    if (x > 1)
     {
-      ans += get_line_score(x + w, sw, min_(h - 2, x), id);
+      add_line_scores(x + w, se, 2, min_(w - x - 1, h - 2), ans);
+      add_line_scores(x + (h - 2) * w, ne, 3, min_(w - x - 1, h - 2), ans);
     }
   }
-  return ans;
 }
 
+// sets the state of the generator of the tie-break noise of `line_heur`. every search seeds its own generator, so a game with a fixed seed is reproducible, and the threads do not share any state
+void seed_line_heur(uint seed)
+{
+  noise = seed * 2654435761u | 1;
+}
+
+// returns the next tie-break noise, a number from 0 to `eval_scale - 1` (xorshift generator)
+static int next_noise()
+{
+  noise ^= noise << 13;
+  noise ^= noise >> 17;
+  noise ^= noise << 5;
+  return (int)(noise >> 24) % eval_scale;
+}
+
+// returns the weight of a score of the active player (`sign == 1`) or of the opponent (`sign == -1`) in units of `1 / eval_scale`
+static int get_weight(int sign)
+{
+  return (int)((active_player->aggressiveness + sign) * eval_scale + sign * 0.5f);
+}
+
+// returns the score of the board in units of `1 / eval_scale` from the point of view of player `pid`
 // assumes `get_simple_move()` returns 0
-float line_heur()
+int line_heur()
 {
-  float ans;
-  if (track_board_value)
+  int ans, board_value[3];
+  if (track_board_value && active_player->track_board_value)
   {
-    ans = board_value * (pid == active_id ? 1 : -1);
+    ans = get_weight(1) * board_scores[(int)active_id] + get_weight(-1) * board_scores[3 - active_id];
+    ans *= pid == active_id ? 1 : -1;
   }
   else
   {
-    ans = (active_player->aggressiveness + 1) * get_board_score(pid) + (active_player->aggressiveness - 1) * get_board_score(3 - pid);
+    get_board_scores(board_value);
+    ans = get_weight(1) * board_value[(int)pid] + get_weight(-1) * board_value[3 - pid];
   }
-  return ans + (float)rand() / RAND_MAX;
+  return ans + next_noise();
 }
 
 static void setup_line(int v, int id_d, int d, int line_length)
@@ -326,7 +415,7 @@ static void setup_line(int v, int id_d, int d, int line_length)
         {
           if (len <= max_mask_length)
           {
-            mask_pointer = (int *)malloc_safe(sizeof(int));
+            mask_pointer = &masks[mask_count++];
             if (len < max_mask_length)
             {
               mask += three_power[len] * 2;
@@ -356,7 +445,7 @@ static void setup_line(int v, int id_d, int d, int line_length)
       }
       else
       {
-        if (board[v] == id)
+        if (board[v] == id && len < max_mask_length)
         {
           mask += three_power[len];
         }
@@ -375,6 +464,7 @@ static void setup_lines()
     lines[i].value = 0;
     lines[i].length = 0;
   }
+  mask_count = 0;
   for (y = 1; y < h - 1; y++)
   {
     setup_line(1 + w * y, east_id, 1, w - 2);
@@ -392,12 +482,144 @@ static void setup_lines()
   }
 }
 
+// fills the range of `scores` of the `ScoreFiller` `arg`
+static void fill_scores(void *arg)
+{
+  ScoreFiller *filler;
+  char squares[max_table_segment];  // `max_mask_length` is at most 15 as well
+  int mask, i, x, score;
+  filler = (ScoreFiller *)arg;
+  x = filler->from;
+  for (i = 0; i < max_mask_length; i++)
+  {
+    squares[i] = (char)(x % 3);
+    x /= 3;
+  }
+  for (mask = filler->from; mask < filler->to; mask++)
+  {
+    score = (int)get_line_score(squares, 1, max_mask_length, 1);
+    if (score > USHRT_MAX)
+    {
+      fail_("the score %d of mask %d does not fit in the table", score, mask);
+    }
+    scores[mask] = (unsigned short)score;
+    // counts `squares` up to the digits of `mask + 1`
+    for (i = 0; i < max_mask_length && squares[i] == 2; i++)
+    {
+      squares[i] = 0;
+    }
+    if (i < max_mask_length)
+    {
+      squares[i]++;
+    }
+  }
+}
+
+// computes the tables `scores` and `segment_scores`
+// `scores` has 3^15 entries at `-mml 15`, so its ranges are filled on `threads` threads, before the threads of the search exist. the scores of a mask and of its reverse differ, as `get_line_score` reads a line from one end, so the table can not be halved by storing a single mask of every pair
+static void fill_score_tables()
+{
+  char squares[max_table_segment];
+  int index, length, i, score, count, masks;
+  ScoreFiller *fillers;
+  masks = three_power[max_mask_length];
+  count = masks >= parallel_fill_masks ? threads : 1;
+  fillers = (ScoreFiller *)malloc_safe(count * sizeof(ScoreFiller));
+  for (i = 0; i < count; i++)
+  {
+    fillers[i].from = (int)((ullong)masks * i / count);
+    fillers[i].to = (int)((ullong)masks * (i + 1) / count);
+  }
+  for (i = 1; i < count; i++)
+  {
+    thread_start(&fillers[i].thread, fill_scores, &fillers[i]);
+  }
+  fill_scores(&fillers[0]);
+  for (i = 1; i < count; i++)
+  {
+    thread_join(&fillers[i].thread);
+  }
+  free(fillers);
+  for (index = 1; index < 2 << max_table_segment; index++)
+  {
+    length = 63 - clz64((ullong)index);
+    for (i = 0; i < length; i++)
+    {
+      squares[i] = (char)(index >> i & 1);
+    }
+    score = get_line_score(squares, 1, length, 1);
+    if (score > USHRT_MAX)
+    {
+      fail_("the score %d of segment %d does not fit in the table", score, index);
+    }
+    segment_scores[index] = (unsigned short)score;
+  }
+}
+
+// returns by how much player `id`'s score of the segment `line` (a segment longer than `max_mask_length`) changes when a stone of player `stone` is placed at square `v`
+// only the part of the segment around `v` is evaluated. the segment is cut at the stones of the opponent, and in the middle of every run of 2n - 2 empty squares that does not contain `v`. an opportunity never crosses such a cut, as the stones of an opportunity lie within n squares of each other and its ends lie within n - 1 squares of its stones. so the cost does not depend on the length of the segment, but only on the stones near `v`
+static int get_segment_delta(Line *line, int d, int v, int id, int stone)
+{
+  int i, lo, hi, run, length;
+  char x;
+  int ans;
+  i = (v - line->v) / d;
+  lo = 0;
+  hi = line->length;
+  // a short segment is evaluated as a whole, as finding the cuts would cost more than it saves
+  if (line->length > 4 * n - 4)
+  {
+    run = 0;
+    for (lo = i - 1; lo >= 0; lo--)
+    {
+      x = board[line->v + d * lo];
+      if (x && x != id)
+      {
+        break;
+      }
+      run = x ? 0 : run + 1;
+      if (run == 2 * n - 2)
+      {
+        lo += n - 2;
+        break;
+      }
+    }
+    lo++;
+    run = 0;
+    for (hi = i + 1; hi < line->length; hi++)
+    {
+      x = board[line->v + d * hi];
+      if (x && x != id)
+      {
+        break;
+      }
+      run = x ? 0 : run + 1;
+      if (run == 2 * n - 2)
+      {
+        hi -= n - 2;
+        break;
+      }
+    }
+  }
+  length = hi - lo;
+  ans = -get_line_score(board + line->v + d * lo, d, length, id);
+  for (i = 0; i < length; i++)
+  {
+    segment[i] = board[line->v + d * (lo + i)];
+  }
+  segment[(v - line->v) / d - lo] = (char)stone;
+  return ans + get_line_score(segment, 1, length, id);
+}
+
+// updates the board value for a stone of player `stone` at square `v`, which is about to be placed by `submit_move`
 // assumption: `!board[v]`
 void update_board_value(int v, int stone)
 {
   int id, id_d;
   int dirs[4] = { 1, w, 1 + w, 1 - w };
   Line *line;
+  board_score_history[2 * turn] = board_scores[1];
+  board_score_history[2 * turn + 1] = board_scores[2];
   for (id = 1; id <= 2; id++)
   {
     for (id_d = 0; id_d < 4; id_d++)
@@ -405,25 +627,25 @@ void update_board_value(int v, int stone)
       line = &lines[get_line_index(v, id, id_d)];
       if (line->value)
       {
-        board_value -= multipliers[id] * scores[*line->mask];
+        board_scores[id] -= scores[*line->mask];
         *line->mask += line->value * (stone == id ? 1 : 2);
-        board_value += multipliers[id] * scores[*line->mask];
+        board_scores[id] += scores[*line->mask];
       }
       else if (line->length)
       {
-        board_value -= multipliers[id] * get_line_score(line->v, dirs[id_d], line->length, id);
-        board[v] = stone;
-        board_value += multipliers[id] * get_line_score(line->v, dirs[id_d], line->length, id);
-        board[v] = 0;
+        board_scores[id] += get_segment_delta(line, dirs[id_d], v, id, stone);
       }
     }
   }
 }
 
+// reverts `update_board_value` for the stone at square `v`, which is being removed by `undo_move`
 void revert_board_value(int v)
 {
   int id, id_d;
   Line *line;
+  board_scores[1] = board_score_history[2 * turn];
+  board_scores[2] = board_score_history[2 * turn + 1];
   for (id = 1; id <= 2; id++)
   {
     for (id_d = 0; id_d < 4; id_d++)
@@ -437,39 +659,53 @@ void revert_board_value(int v)
   }
 }
 
-static void initialize_scores()
+// sets up the lines of the current board, unless they are already being tracked. the lines then stay up to date until `stop_tracking_board_value` is called
+// the lines are kept when the tracking stops, so if the game only went on since then, the moves made in the meantime (usually the last move of each player) are undone and made again with the tracking on. only otherwise all lines are set up anew
+void start_tracking_board_value()
 {
-  char *backup_board;
-  int i, j, mask;
-  nscores = three_power[max_mask_length];
-  scores = (float *)malloc_safe(sizeof(float) * nscores);
-  backup_board = board;
-  board = (char *)malloc_safe(sizeof(char) * max_mask_length);
-  for (i = 0; i < nscores; i++)
+  int mark;
+  char pid_before;
+  if (track_board_value)
   {
-    mask = i;
-    for (j = 0; j < max_mask_length; j++)
+    return;
+  }
+  if (lines_kept && lines_turn <= turn)
+  {
+    mark = board_mark();
+    pid_before = pid;
+    board_rollback(lines_turn);
+    track_board_value = (hash ^ (pid == 2 ? zobrist_side : 0)) == lines_hash;
+    board_redo(mark);
+    set_p(pid_before);
+    if (track_board_value)
     {
-      board[j] = mask % 3;
-      mask /= 3;
+      return;
     }
-    scores[i] = get_line_score(0, 1, max_mask_length, 1);
   }
-  free(board);
-  board = backup_board;
-}
-
-void start_tracking_board_value()
-{
-  multipliers[(int)active_id] = active_player->aggressiveness + 1;
-  multipliers[3 - active_id] = active_player->aggressiveness - 1;
   setup_lines();
-  board_value = multipliers[1] * get_board_score(1) + multipliers[2] * get_board_score(2);
+  get_board_scores(board_scores);
   track_board_value = 1;
 }
 
+// stops keeping the lines up to date, such that the moves of the searches that run without them (such as the threat space searches) do not pay for it
 void stop_tracking_board_value()
 {
-  free_masks();
+  int board_value[3];
+  // the tracked scores are compared with a full evaluation of the board once per search
+  if (track_board_value && sanity_checks)
+  {
+    get_board_scores(board_value);
+    if (board_value[1] != board_scores[1] || board_value[2] != board_scores[2])
+    {
+      fail_("the tracked scores (%d, %d) differ from the scores of the board (%d, %d)", board_scores[1], board_scores[2], board_value[1], board_value[2]);
+    }
+  }
+  if (track_board_value)
+  {
+    // the key without the player to move, as the lines do not depend on it
+    lines_kept = 1;
+    lines_turn = turn;
+    lines_hash = hash ^ (pid == 2 ? zobrist_side : 0);
+  }
   track_board_value = 0;
 }
@@ -44,6 +44,7 @@ static void test_block_configuration()
         empty_squares++;
       }
     }
+    reset_candidates();
   }
   else
   {
@@ -67,16 +68,14 @@ void load_custom_board()
   {
     if (!board[to_v(i)])
     {
-      board[to_v(i)] = 3;
-      empty_squares--;
+      place_stone(to_v(i), 3);
     }
   }
   for (k = 0; k < random_blocks; k++)
   {
     if (empty_squares)
     {
-      board[random_empty_square()] = 3;
-      empty_squares--;
+      place_stone(random_empty_square(), 3);
     }
   }
   if (!empty_squares)
@@ -116,7 +115,7 @@ void load_custom_board()
     }
   }
   turn = 0;
-  list_clear(&actions);
+  actions.length = 0;
   if (json_client && show_board)
   {
     send_board();
@@ -143,7 +142,7 @@ static void read_command_line_arguments()
     parser_read_help("-h", "--help", "show this help message");
     parser_read_int("-w", "--width", &w, 15, 1, 100, "set the width and height of the playing field");
     parser_read_int("-H", "--height", &h, 0, 0, 100, "specify a different height for the playing field");
-    parser_read_int("-n", "--stones-to-win", &n, 5, 1, 100, "set the required minimum number of stones in a row to win");
+    parser_read_int("-n", "--stones-to-win", &n, 5, 1, 64, "set the required minimum number of stones in a row to win");
     parser_read_bool("-q", "--quiet", &verbose, 1, "no verbose logging");
     parser_read_bool("-vq", "--very-quiet", &slightly_verbose, 1, "no slightly-verbose logging");
     parser_read_bool("-uv", "--ultra-verbose", &ultra_verbose, 0, "enable ultra-verbose logging");
@@ -169,7 +168,15 @@ static void read_command_line_arguments()
     parser_read_bool2("-um", "--unsafe-moves", &p->play_safe_move, &q->play_safe_move, 1, "do not search for safe moves");
     parser_read_bool2("-nt", "--no-tracking", &p->track_board_value, &q->track_board_value, 1, "parameter used by alpha-beta");
     parser_read_int("-mml", "--max-mask-length", &max_mask_length, 10, 1, 15, "parameter used by alpha-beta");
+    parser_read_int("-th", "--threads", &threads, 1, 1, 256, "set the number of threads used by the alpha-beta search, by the combination stages of the threat space search and by the search for a safe move");
+    parser_read_bool("-po", "--ponder", &ponder, 0, "let the ai search on the time of the opponent when playing against a human or in brain mode");
+    parser_read_int("-tts", "--tt-size", &tt_size, 16, 0, 4096, "set the size (in megabytes) of the transposition table of alpha-beta. a size of 0 disables the table");
+    parser_read_int("-tcs", "--tss-cache-size", &tss_cache_size, 4, 0, 4096, "set the size (in megabytes) of the cache of the threat space searches. a size of 0 disables the cache");
     parser_read_float2("-ag", "--aggressiveness", &p->aggressiveness, &q->aggressiveness, 0, -1, 1, "determines the aggressiveness of the alpha-beta search");
+    parser_read_bool2("-lmr", "--late-move-reductions", &p->late_move_reductions, &q->late_move_reductions, 0, "let alpha-beta search the late quiet moves with a reduced depth first");
+    parser_read_bool2("-nmp", "--null-move-pruning", &p->null_move_pruning, &q->null_move_pruning, 0, "let alpha-beta cut off positions in which passing the turn is already good enough");
+    parser_read_bool2("-fp", "--futility-pruning", &p->futility_pruning, &q->futility_pruning, 0, "let alpha-beta skip the quiet moves at the frontier nodes whose score cannot reach alpha");
+    parser_read_bool2("-qs", "--quiescence-search", &p->quiescence_search, &q->quiescence_search, 0, "let alpha-beta resolve the fours of the player to move at the leaves before evaluating them");
     parser_read_bool2("-of", "--only-fours", &p->only_fours, &q->only_fours, 0, "only consider four-threat sequences");
     parser_read_bool2("-tb", "--table", &p->use_table, &q->use_table, 0, "temporary");
     parser_read_bool("-nc", "--no-combinations", &allow_combinations, 1, "skip the combination stages of the threat space search");
@@ -14,9 +14,9 @@ typedef struct Node
   struct Node *prev;  // previous child of parent
 } Node;
 
-static char root_id;  // id of the player corresponding to the root node
-static int ans;  // whether the position is proven or disproven
-static int returned_move; // the move returned by the search
+static thread_local_ char root_id;  // id of the player corresponding to the root node
+static thread_local_ int ans;  // whether the position is proven or disproven
+static thread_local_ int returned_move; // the move returned by the search
 
 static void update(Node *, char);
 
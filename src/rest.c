@@ -1,5 +1,22 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include "shared.h"
 
+#define soft_time_fraction 0.5f  // the soft deadline of the iterative deepening lies at this fraction of the time it has left. an iteration started after it would most likely not finish before the hard deadline
+#define time_check_period 1e-3f  // the clock is read about this often (in seconds) by `is_out_of_time`
+#define max_time_check_interval 4096
+#define brain_time_margin 0.03f  // the time (in seconds) reserved in brain mode for the communication with the manager
+#define max_match_fraction 0.25f  // a single turn never takes more than this fraction of the remaining match time
+
+thread_local_ volatile int *stop_signal;  // if set then the search of this thread is stopped as soon as `*stop_signal` becomes non-zero
+static thread_local_ int time_check_countdown;  // the number of calls to `is_out_of_time` until the clock is read again
+static thread_local_ int time_check_interval;  // the value `time_check_countdown` is reset to after the clock is read
+static thread_local_ float last_time_check;  // the time stamp of the last reading of the clock by `is_out_of_time`
+static thread_local_ float allotted_time;  // the time initially given to the current turn by `allocate_turn_time`
+
 int ai_random()
 {
   if (verbose)
@@ -95,9 +112,26 @@ void *realloc_safe(void *ptr, size_t size)
   return a;
 }
 
+// returns the number of seconds since the first call, measured by a monotonic wall clock. the processor time (as returned by `clock`) is of no use once the search runs on multiple threads
 float get_time()
 {
-  return (float)clock() / CLOCKS_PER_SEC;
+  static double origin = -1;
+  double t;
+#ifdef _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  t = (double)counter.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  t = ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+  if (origin < 0)
+  {
+    origin = t;
+  }
+  return (float)(t - origin);
 }
 
 float time_left()
@@ -107,28 +141,120 @@ float time_left()
 
 float get_elapsed_time()
 {
-  static float last_time = 0;
+  static thread_local_ float last_time = 0;
   float ans;
   ans = get_time() - last_time;
   last_time = get_time();
   return ans;
 }
 
+// sets the deadline of the search to `duration` seconds from now. the soft deadline is the same, until `set_soft_deadline` moves it. as the next search may have much more expensive nodes than the last one, the interval of `is_out_of_time` starts from 1 again
 void set_time_limit(float duration)
 {
-  stop_time = get_time() + duration;
+  last_time_check = get_time();
+  stop_time = last_time_check + duration;
+  soft_stop_time = stop_time;
   out_of_time = 0;
+  time_check_countdown = 0;
+  time_check_interval = 1;
 }
 
+// returns whether the hard deadline has passed or the search is stopped. called at every node of the searches, so the clock is only read once every `time_check_interval` calls. this interval is adapted such that the clock is read about every `time_check_period` seconds, whatever the cost of a node
 int is_out_of_time()
 {
-  if (get_time() > stop_time)
+  float t;
+  if (stop_signal && *stop_signal)
+  {
+    out_of_time = 1;
+  }
+  if (out_of_time || --time_check_countdown > 0)
+  {
+    return out_of_time;
+  }
+  t = get_time();
+  if (t > stop_time)
   {
     out_of_time = 1;
   }
+  if (t - last_time_check < time_check_period)
+  {
+    time_check_interval = min_(2 * time_check_interval, max_time_check_interval);
+  }
+  else if (t - last_time_check > 2 * time_check_period)
+  {
+    time_check_interval = max_(time_check_interval / 2, 1);
+  }
+  last_time_check = t;
+  time_check_countdown = time_check_interval;
   return out_of_time;
 }
 
+// moves the soft deadline to a fraction of the time left before the hard deadline. only used by the iterative deepening of a turn, as the other searches have no iterations that are worth skipping
+void set_soft_deadline()
+{
+  float t;
+  t = get_time();
+  soft_stop_time = t + (stop_time - t) * soft_time_fraction;
+}
+
+// returns whether the soft deadline has passed, in which case an iterative search should not start its next iteration
+int is_past_soft_deadline()
+{
+  return get_time() > soft_stop_time;
+}
+
+// returns the number of turns the current player still expects to make in the match, which decreases as the playing field fills up
+static int expected_turns_left()
+{
+  return max_(8, min_(30, empty_squares / 8));
+}
+
+// sets the time stamps of the start and the end of the turn of the current player. the time allowed for a turn is `p->time_limit`. in brain mode with a match time limit, the remaining match time is split over the expected remaining turns instead (within the turn time limit). a turn may then be extended up to a fraction of the remaining match time
+void allocate_turn_time()
+{
+  float limit;
+  start_of_turn = get_time();
+  limit = p->time_limit;
+  if (brain)
+  {
+    limit = max_(limit - brain_time_margin, 0);
+  }
+  max_end_of_turn = start_of_turn + limit;
+  end_of_turn = max_end_of_turn;
+  if (brain && timeout_match > 0)
+  {
+    limit = max_(match_time_left - brain_time_margin, 0);
+    max_end_of_turn = start_of_turn + min_(max_end_of_turn - start_of_turn, limit * max_match_fraction);
+    end_of_turn = min_(max_end_of_turn, start_of_turn + limit / expected_turns_left());
+  }
+  allotted_time = end_of_turn - start_of_turn;
+}
+
+// allows the turn to take `fraction` times the time it was given initially more, but not beyond `max_end_of_turn`. moves the deadlines of the running search along
+void extend_turn(float fraction)
+{
+  float delta;
+  delta = min_(max_end_of_turn, end_of_turn + fraction * allotted_time) - end_of_turn;
+  if (delta > 0)
+  {
+    end_of_turn += delta;
+    stop_time += delta;
+    soft_stop_time += delta;
+  }
+}
+
+// records by how much the turn that just ended exceeded its time limit
+void record_overshoot()
+{
+  float overshoot;
+  overshoot = get_time() - max_end_of_turn;
+  max_overshoot = max_(max_overshoot, overshoot);
+  if (ultra_verbose)
+  {
+    print_("the turn ended %.3f sec %s the time limit", fabs(overshoot), overshoot > 0 ? "after" : "before");
+  }
+}
+
 void on_wts()
 {
   if (halt_on_wts && !manual_steps && no_human_player())
@@ -153,7 +279,7 @@ void on_wts()
   }
 }
 
-float truncate(float x, float a, float b)
+int truncate(int x, int a, int b)
 {
   if (x < a)
   {
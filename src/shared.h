@@ -18,6 +18,7 @@
 #define fail_(s, ...) { fprintf(stderr, "fatal error in %s at line %d: ", __FILE__, __LINE__); fprintf(stderr, s, ##__VA_ARGS__); fprintf(stderr, "\n"); fail(); }
 #define print_(s, ...) { print_player_prefix(); printf(s, ##__VA_ARGS__); }
 #define draw 3
+#define eval_scale 16  // the scores of the alpha-beta search are integers in units of `1 / eval_scale` of a point of the line scores
 
 #ifndef brain
 // adds support for communication with gomoku interfaces like piskvork (http://gomocup.org/piskvork/). the protocol is explained at http://petr.lastovicka.sweb.cz/protocl2en.htm
@@ -28,6 +29,13 @@
 #define file ""
 #endif
 
+// storage class of the variables of which every thread has its own copy, such as the state of the board
+#ifdef _MSC_VER
+#define thread_local_ __declspec(thread)
+#else
+#define thread_local_ __thread
+#endif
+
 typedef unsigned long long ullong;
 typedef unsigned int uint;
 
@@ -53,12 +61,16 @@ typedef struct Player
 {
   float time_limit;  // the time (in seconds) the player is allowed to spend on each turn
   int(*get_next_move)();  // computes the next move for this player
-  float(*heuristic)();  // the evaluation heuristic for alpha-beta
+  int(*heuristic)();  // the evaluation heuristic for alpha-beta
   float *scores;  // determines the order in which the moves are traversed by the alpha-beta search
-  float(*alpha_beta)(float, float, int, int);  // the alpha-beta function to use
+  int(*alpha_beta)(int, int, int, int);  // the alpha-beta function to use
   int fixed_depth;  //  if `fixed_depth > 0` then the alpha-beta search is of depth `fixed_depth` and we do not use iterative deepening
   int track_board_value;
   float aggressiveness;
+  int late_move_reductions;  // whether the alpha-beta search reduces the depth of moves late in the move order
+  int null_move_pruning;  // whether the alpha-beta search cuts off a position if passing the turn is already good enough
+  int futility_pruning;  // whether the alpha-beta search skips the quiet moves at the frontier nodes that are too far below `alpha`
+  int quiescence_search;  // whether the alpha-beta search resolves the fours of the player to move at the leaves before evaluating them
   List *fours;
   char *five_count;
   List fives;
@@ -76,32 +88,92 @@ typedef struct Player
   char *fl_count;
 } Player;
 
+// a change of the threat lists or of the winner, which is reverted when the move of turn `turn` is undone
+typedef struct Action
+{
+  char type;
+  int turn;
+  int v, u;  // the squares of a created four-threat
+} Action;
+
+typedef struct ActionList
+{
+  Action *values;
+  int length;
+  int size;
+} ActionList;
+
+// the state of a game that is private to a thread. `engine_copy` creates such a state from the current state of the calling thread, after which another thread can continue from it with `engine_load`
+// every mutable variable of the engine is `thread_local_`, so any number of engines can be loaded at the same time on different threads. the state owned by the modules themselves (such as the threats of the threat space searches) is allocated per thread by `engine_thread_ini`
+typedef struct Engine
+{
+  char *board;
+  char *nearby;
+  ullong *line_bits;
+  ullong *near_bits;
+  ullong *occupied_bits;
+  int *moves;
+  int turn;
+  int empty_squares;
+  char winner;
+  char pid;
+  char active_id;
+  int active_turn;
+  ullong hash;
+  ActionList actions;
+  Player players[2];
+  char *win_board;
+} Engine;
+
+typedef struct Thread
+{
+  void *handle;
+} Thread;
+
+typedef struct Mutex
+{
+  void *handle;
+} Mutex;
+
+typedef struct Cond
+{
+  void *handle;
+} Cond;
+
 extern int max_mask_length;
-extern int track_board_value;
-extern float board_value;
-extern float *board_values;
+extern int threads;
+extern int ponder;
+extern thread_local_ volatile int *stop_signal;
+extern int tt_size;
+extern int tss_cache_size;
+extern thread_local_ int track_board_value;
 extern int w, h;
 extern int size;
 extern int ne, se, nw, sw;
 extern int v0, v1;
 extern int n;
-extern int turn;
-extern int active_turn;
-extern int empty_squares;
-extern int *moves;
-extern char *board;
-extern char winner;
-extern char pid, qid;
-extern int first_print;
-extern Player *p;
-extern Player *q;
-extern char *nearby;
+extern thread_local_ int turn;
+extern thread_local_ int active_turn;
+extern thread_local_ int empty_squares;
+extern thread_local_ int *moves;
+extern thread_local_ char *board;
+extern thread_local_ char winner;
+extern thread_local_ char pid, qid;
+extern thread_local_ int first_print;
+extern thread_local_ Player *p;
+extern thread_local_ Player *q;
+extern thread_local_ char *nearby;
 extern int verbose;
-extern float start_of_turn;
-extern float end_of_turn;
-extern float stop_time;
+extern thread_local_ float start_of_turn;
+extern thread_local_ float end_of_turn;
+extern thread_local_ float max_end_of_turn;
+extern float timeout_match;
+extern float match_time_left;
+extern thread_local_ float stop_time;
+extern thread_local_ float soft_stop_time;
+extern float max_overshoot;
 extern int slightly_verbose;
-extern int out_of_time;
+extern thread_local_ int out_of_time;
 extern int ultra_verbose;
 extern int manual_steps;
 extern int halt_on_wts;
@@ -109,20 +181,18 @@ extern int show_board;
 extern int json_client;
 extern int satisfied_with_draw;
 extern int allow_combinations;
-extern char *win_board;
-extern char *conflict_board;
-extern int safe_move;
+extern thread_local_ char *win_board;
+extern thread_local_ ullong win_board_key;
+extern thread_local_ int safe_move;
 extern int swap_colors;
-extern Player players[];
-extern Player *active_player;
-extern char active_id;
-extern const float winscore;
-extern const float drawscore;
+extern thread_local_ Player players[2];
+extern thread_local_ Player *active_player;
+extern thread_local_ char active_id;
+extern const int winscore;
+extern const int drawscore;
 extern int(*default_ai)();
 extern int random_moves;
 extern int random_blocks;
-extern const float winscore;
-extern const float drawscore;
 extern char black_id;
 extern char white_id;
 extern int auto_start;
@@ -134,11 +204,19 @@ extern int games_played;
 extern int draws;
 extern int fixed_colors;
 extern int print_every_board;
-extern TssResult result;
+extern thread_local_ TssResult result;
 extern int initial_seed;
-extern int found_wts;
-extern List actions;
+extern thread_local_ int found_wts;
+extern thread_local_ ActionList actions;
 extern int human_supervisor;
+extern thread_local_ ullong hash;
+extern ullong *zobrist;
+extern ullong zobrist_side;
+extern thread_local_ ullong *line_bits;
+extern int line_bits_size;
+extern thread_local_ ullong *near_bits;
+extern thread_local_ ullong *occupied_bits;
+extern int candidate_words;
 
 // main
 void load_custom_board();
@@ -151,24 +229,39 @@ void run_game();
 
 // board
 void board_clear(char *);
+void zobrist_ini();
 char set_p(char);
-int tail_length(int, int, char);
 void update_nearby(int, int);
+void reset_candidates();
 void submit_move(int);
 void submit_moves(int, int *);
 void place_stone(int, char);
 void undo_move();
 void undo_moves(int);
+void board_follow(const int *, int);
 int get_simple_move();
 int do_forced_move_opt();
 int random_empty_square();
 int random_empty_nearby_square();
 int not_nearby(int);
-int *copy_moves();
-void restore_moves(int *);
+int board_mark();
+void board_rollback(int);
+void board_redo(int);
+void actions_ini(ActionList *);
+void actions_cleanup(ActionList *);
 int compare_scores(int, int);
 int win_in_3(char);
 int win_within_3();
+void engine_copy(Engine *);
+void engine_load(Engine *);
+void engine_save(Engine *);
+void engine_free(Engine *);
+void engine_thread_ini();
+void engine_thread_cleanup();
+
+// bitboard
+void file_bitboard_ini();
+void file_bitboard_cleanup();
 
 // io
 void print_game_state(FILE *);
@@ -195,21 +288,45 @@ float get_time();
 float time_left();
 void set_time_limit(float);
 int is_out_of_time();
+void set_soft_deadline();
+int is_past_soft_deadline();
+void allocate_turn_time();
+void extend_turn(float);
+void record_overshoot();
 void on_wts();
-float truncate(float, float, float);
+int truncate(int, int, int);
 int get_d(int, int);
 float get_elapsed_time();
 void print_time(float, const char *);
 
+// thread
+void thread_start(Thread *, void(*)(void *), void *);
+void thread_join(Thread *);
+void mutex_ini(Mutex *);
+void mutex_cleanup(Mutex *);
+void mutex_lock(Mutex *);
+void mutex_unlock(Mutex *);
+void cond_ini(Cond *);
+void cond_cleanup(Cond *);
+void cond_wait(Cond *, Mutex *);
+void cond_broadcast(Cond *);
+
 // alpha beta
-float alpha_beta(float, float, int, int);
+void file_alpha_beta_ini();
+void file_alpha_beta_cleanup();
+int alpha_beta(int, int, int, int);
 int iterative_deepening(char *);
 int ai_alpha_beta();
+void start_pondering();
+void stop_pondering(int);
 
 // line heur
-float line_heur();
+int line_heur();
+void seed_line_heur(uint);
 void file_line_heur_ini();
 void file_line_heur_cleanup();
+void file_line_heur_thread_ini();
+void file_line_heur_thread_cleanup();
 void start_tracking_board_value();
 void stop_tracking_board_value();
 void update_board_value(int, int);
@@ -220,6 +337,8 @@ int tss_fours(char);
 int tss_fours_unsafe(char);
 void file_tss_fours_ini();
 void file_tss_fours_cleanup();
+void file_tss_fours_thread_ini();
+void file_tss_fours_thread_cleanup();
 int is_safe_move(int);
 int tss_counter(char);
 int tss(char);
@@ -227,6 +346,15 @@ int tss_quiescence(char);
 int ai_tss();
 void file_tss_ini();
 void file_tss_cleanup();
+void file_tss_thread_ini();
+void file_tss_thread_cleanup();
+
+// tss cache
+void file_tss_cache_ini();
+void file_tss_cache_cleanup();
+ullong tss_cache_key(char, ullong);
+int tss_cache_probe(ullong, TssResult *);
+void tss_cache_store(ullong, const TssResult *);
 
 // table
 int table_fours(char);
@@ -236,4 +364,6 @@ int table_tss();
 int pns();
 int ai_pns();
 
+#include "bitboard.h"
+
 #endif
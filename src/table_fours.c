@@ -6,19 +6,18 @@
 #define mod (1 << 24)
 #define masklen (index + 1)
 
-static int *table;
-static ullong **masks;
-static int *sizes;
-static int *lengths;
-static ullong *mask;
-static int index;
-static ullong *pow3;
-static int counter;
-static int *nums;
-static uint sum;
-static uint *randoms;
-static int stats_maxchain;
-static int done;
+static thread_local_ int *table;
+static thread_local_ ullong **masks;
+static thread_local_ int *sizes;
+static thread_local_ int *lengths;
+static thread_local_ ullong *mask;
+static thread_local_ int index;
+static thread_local_ ullong *pow3;
+static thread_local_ int counter;
+static thread_local_ int *nums;
+static thread_local_ ullong sum;  // zobrist key of the stones played in the current sequence
+static thread_local_ int stats_maxchain;
+static thread_local_ int done;
 
 static void get_win(int);
 
@@ -58,7 +57,7 @@ static void add_v(int v, int id)
   }
   index = max_(index, k);
   mask[k] += pow3[nums[v] % places] * id;
-  sum += (3 - 2 * id) * randoms[v];
+  sum ^= zobrist[4 * v + (id == 1 ? pid : qid)];
 }
 
 static void remove_v(int v, int id)
@@ -66,7 +65,7 @@ static void remove_v(int v, int id)
   int k;
   k = nums[v] / places;
   mask[k] -= pow3[nums[v] % places] * id;
-  sum -= (3 - 2 * id) * randoms[v];
+  sum ^= zobrist[4 * v + (id == 1 ? pid : qid)];
   if (k && k == index && !mask[k])
   {
     index--;
@@ -90,7 +89,7 @@ static int add_mask()
 {
   uint x, s;
   int i, j, chain;
-  s = sum & (mod - 1);
+  s = (uint)sum & (mod - 1);
   x = table[s];
   chain = 1;
   while (x)
@@ -187,22 +186,6 @@ static void get_win(int depth)
   }
 }
 
-static uint get_rand()
-{
-  uint x, y;
-  int i;
-  y = mod;
-  x = 0;
-  i = 0;
-  while (y > 1)
-  {
-    x |= ((uint)rand() & 32767) << i;
-    i += 15;
-    y >>= 15;
-  }
-  return x;
-}
-
 int table_fours(char id)
 {
   int i, v, m;
@@ -214,11 +197,9 @@ int table_fours(char id)
   sum = 0;
   counter = 0;
   nums = (int *)malloc_safe(sizeof(int) * size);
-  randoms = (uint *)malloc_safe(sizeof(uint) * size);
   for (v = v0; v < v1; v++)
   {
     nums[v] = -1;
-    randoms[v] = get_rand();
   }
   pow3 = (ullong *)malloc_safe(places * sizeof(ullong));
   x = 1;
@@ -247,7 +228,6 @@ int table_fours(char id)
     print_("table_fours stats: maxchain = %d, count = %d, masks = %d", stats_maxchain, counter, m);
   }
   free(nums);
-  free(randoms);
   free(pow3);
   for (i = 0; i < maxlen; i++)
   {
@@ -12,19 +12,18 @@ typedef struct Map
   int length;
 } Map;
 
-static Map *maps;
-static Map *map;
-static long long *mask;
-static List *lists;
-static List *list;
-static int gv_counter;
-static int *nums;
-static unsigned int sum;
-static unsigned int *randoms;
-static int masklen;
-static int stats_maxsumlist;
-static int done;
-static int success;
+static thread_local_ Map *maps;
+static thread_local_ Map *map;
+static thread_local_ long long *mask;
+static thread_local_ List *lists;
+static thread_local_ List *list;
+static thread_local_ int gv_counter;
+static thread_local_ int *nums;
+static thread_local_ unsigned int sum;  // (part of the) zobrist key of the cost squares played in the current sequence
+static thread_local_ int masklen;
+static thread_local_ int stats_maxsumlist;
+static thread_local_ int done;
+static thread_local_ int success;
 
 static void get_win();
 
@@ -207,12 +206,21 @@ static int add_mask()
   return 1;
 }
 
+static unsigned int cost_key(int v)
+{
+  return (unsigned int)zobrist[4 * v + qid];
+}
+
 static void handle_three(int v, int count, int *cvs)
 {
-  int oldsum;
+  int i;
+  unsigned int oldsum;
   add_gv(v);
   oldsum = sum;
-  sum += randoms[cvs[0]] + randoms[cvs[1]] + randoms[cvs[2]];
+  for (i = 0; i < count; i++)
+  {
+    sum ^= cost_key(cvs[i]);
+  }
   if (add_mask())
   {
     submit_move(v);
@@ -230,39 +238,29 @@ static void handle_three(int v, int count, int *cvs)
 
 static void loop_threes(int v)
 {
-  int a, b, x, y, z, d, left, right, ll, rr, dir;
+  int a, b, x, y, z, d, left, right, ll, rr, dir, right_empty, left_empty;
   int dirs[] = { 1, w, 1 + w, 1 - w };
   int cvs[3];
+  LineWindow lw;
   for (dir = 0; dir < 4; dir++)
   {
     d = dirs[dir];
-    a = tail_length(v, d, pid);
-    b = tail_length(v, -d, pid);
+    load_window(&lw, v, d, pid);
+    a = window_run(lw.own[0], lw.up[0], 0);
+    b = window_run(lw.own[1], lw.up[1], 0);
     x = 1 + a + b;
     right = v + (a + 1) * d;
     left = v - (b + 1) * d;
-    if (!board[right])
-    {
-      y = min_(1 + tail_length(right, d, pid), n - x);
-    }
-    else
-    {
-      y = 0;
-    }
-    if (!board[left])
-    {
-      z = min_(1 + tail_length(left, -d, pid), n - x);
-    }
-    else
-    {
-      z = 0;
-    }
-    if (!board[right] && !board[left] && x + y < n && x + z < n
+    right_empty = window_test(lw.empty[0], lw.up[0], a);
+    left_empty = window_test(lw.empty[1], lw.up[1], b);
+    y = right_empty ? min_(1 + window_run(lw.own[0], lw.up[0], a + 1), n - x) : 0;
+    z = left_empty ? min_(1 + window_run(lw.own[1], lw.up[1], b + 1), n - x) : 0;
+    if (right_empty && left_empty && x + y < n && x + z < n
       && (x + y == n - 1 || x + z == n - 1))
     {
       rr = v + (a + y + 1) * d;
       ll = v - (b + z + 1) * d;
-      if (x + y == n - 1 && !board[rr])
+      if (x + y == n - 1 && window_test(lw.empty[0], lw.up[0], a + y))
       {
         y++;
       }
@@ -270,7 +268,7 @@ static void loop_threes(int v)
       {
         y = 1;
       }
-      if (x + z == n - 1 && !board[ll])
+      if (x + z == n - 1 && window_test(lw.empty[1], lw.up[1], b + z))
       {
         z++;
       }
@@ -310,7 +308,7 @@ static void loop_threes(int v)
 static void handle_four(int v, int u)
 {
   add_gv(v);
-  sum += randoms[u];
+  sum ^= cost_key(u);
   if (add_mask())
   {
     submit_move(v);
@@ -322,7 +320,7 @@ static void handle_four(int v, int u)
     }
     undo_move();
   }
-  sum -= randoms[u];
+  sum ^= cost_key(u);
   remove_gv(v);
 }
 
@@ -372,12 +370,9 @@ int table_tss()
   gv_counter = 0;
   maxlen = max_(1, ((empty_squares + 1) / 2 + bits - 1) / bits);
   nums = (int *)malloc_safe(sizeof(int) * size);
-  randoms = (unsigned int *)malloc_safe(sizeof(unsigned int) * size);
-  randoms[0] = 0;
   for (v = v0; v < v1; v++)
   {
     nums[v] = -1;
-    randoms[v] = (unsigned int)rand();
   }
   lists = (List *)calloc_safe(maxlen, sizeof(List));
   maps = (Map *)calloc_safe(maxlen, sizeof(Map));
@@ -398,7 +393,6 @@ int table_tss()
     print_("table_fours stats: maxsumlist = %d, count = %d, masks = %d, success = %d", stats_maxsumlist, gv_counter, masks, success);
   }
   free(nums);
-  free(randoms);
   for (i = 0; i < maxlen; i++)
   {
     list_cleanup(&lists[i]);
@@ -0,0 +1,146 @@
+// a minimal wrapper around the threads of the operating system
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#endif
+#include "shared.h"
+
+typedef struct ThreadStart
+{
+  void(*f)(void *);
+  void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static DWORD WINAPI run(LPVOID arg)
+#else
+static void *run(void *arg)
+#endif
+{
+  ThreadStart start;
+  start = *(ThreadStart *)arg;
+  free(arg);
+  start.f(start.arg);
+  return 0;
+}
+
+// starts a new thread that executes `f(arg)`
+void thread_start(Thread *thread, void(*f)(void *), void *arg)
+{
+  ThreadStart *start;
+  start = (ThreadStart *)malloc_safe(sizeof(ThreadStart));
+  start->f = f;
+  start->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(0, 0, run, start, 0, 0);
+  if (!thread->handle)
+  {
+    fail_("CreateThread failed");
+  }
+#else
+  thread->handle = malloc_safe(sizeof(pthread_t));
+  if (pthread_create((pthread_t *)thread->handle, 0, run, start))
+  {
+    fail_("pthread_create failed");
+  }
+#endif
+}
+
+// waits until `thread` has finished
+void thread_join(Thread *thread)
+{
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(*(pthread_t *)thread->handle, 0);
+  free(thread->handle);
+#endif
+}
+
+void mutex_ini(Mutex *mutex)
+{
+#ifdef _WIN32
+  mutex->handle = malloc_safe(sizeof(CRITICAL_SECTION));
+  InitializeCriticalSection((CRITICAL_SECTION *)mutex->handle);
+#else
+  mutex->handle = malloc_safe(sizeof(pthread_mutex_t));
+  if (pthread_mutex_init((pthread_mutex_t *)mutex->handle, 0))
+  {
+    fail_("pthread_mutex_init failed");
+  }
+#endif
+}
+
+void mutex_cleanup(Mutex *mutex)
+{
+#ifdef _WIN32
+  DeleteCriticalSection((CRITICAL_SECTION *)mutex->handle);
+#else
+  pthread_mutex_destroy((pthread_mutex_t *)mutex->handle);
+#endif
+  free(mutex->handle);
+}
+
+void mutex_lock(Mutex *mutex)
+{
+#ifdef _WIN32
+  EnterCriticalSection((CRITICAL_SECTION *)mutex->handle);
+#else
+  pthread_mutex_lock((pthread_mutex_t *)mutex->handle);
+#endif
+}
+
+void mutex_unlock(Mutex *mutex)
+{
+#ifdef _WIN32
+  LeaveCriticalSection((CRITICAL_SECTION *)mutex->handle);
+#else
+  pthread_mutex_unlock((pthread_mutex_t *)mutex->handle);
+#endif
+}
+
+void cond_ini(Cond *cond)
+{
+#ifdef _WIN32
+  cond->handle = malloc_safe(sizeof(CONDITION_VARIABLE));
+  InitializeConditionVariable((CONDITION_VARIABLE *)cond->handle);
+#else
+  cond->handle = malloc_safe(sizeof(pthread_cond_t));
+  if (pthread_cond_init((pthread_cond_t *)cond->handle, 0))
+  {
+    fail_("pthread_cond_init failed");
+  }
+#endif
+}
+
+void cond_cleanup(Cond *cond)
+{
+#ifndef _WIN32
+  pthread_cond_destroy((pthread_cond_t *)cond->handle);
+#endif
+  free(cond->handle);
+}
+
+// unlocks `mutex`, which the calling thread holds, and waits until `cond` is broadcast. then locks `mutex` again. the wait may also end spuriously, so the caller checks its condition in a loop
+void cond_wait(Cond *cond, Mutex *mutex)
+{
+#ifdef _WIN32
+  SleepConditionVariableCS((CONDITION_VARIABLE *)cond->handle, (CRITICAL_SECTION *)mutex->handle, INFINITE);
+#else
+  pthread_cond_wait((pthread_cond_t *)cond->handle, (pthread_mutex_t *)mutex->handle);
+#endif
+}
+
+// wakes up all threads that wait for `cond`
+void cond_broadcast(Cond *cond)
+{
+#ifdef _WIN32
+  WakeAllConditionVariable((CONDITION_VARIABLE *)cond->handle);
+#else
+  pthread_cond_broadcast((pthread_cond_t *)cond->handle);
+#endif
+}
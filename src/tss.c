@@ -35,7 +35,7 @@
 
 // # IMPLEMENTATION
 
-// each threat `t` we give an index `t->index` in such a way that if `t` depends on `t'`, then `t->index` is greater than `t'->index`
+// each threat `t` we give an index, its position in `threats`, in such a way that if `t` depends on `t'`, then the index of `t` is greater than the index of `t'`
 // the dependency graph of a threat `t` is a directed graph with root `t`, such that the children of each node `t'` are the threats on which `t'` depends
 // the threat sequence ending in a threat `t` consists of all the threats in the dependency graph of `t`, ordered by ascending index
 // we only look at such threat sequences. therefore, not every possibly winning threat sequence will be found (todo: add example)
@@ -53,6 +53,8 @@
 
 #include "shared.h"
 
+#define parallel_combine_threats 16  // a combination stage of the search of the current position is split over `threads` threads if it starts from at least this many new threats
+
 typedef struct Threat
 {
   int gv;  // gain vector
@@ -60,62 +62,187 @@ typedef struct Threat
   int evs[2];  // end vectors
   int cv_count;  // cost vector count
   int ev_count;  // end vector count
-  struct Threat *parent_threats[4];  // the parent threats, ie, the threats on which this threat depends
+  int parent_threats[4];  // the indices of the parent threats, ie, the threats on which this threat depends
   char parent_count;  // the parent threat count
-  int index;  // the index of this threat in `threats`
+  int ancestors;  // the offset in `ancestor_bits` of the threats in the dependency graph of this threat, a bitset of `index / 64 + 1` words over the indices of the threats
 } Threat;
 
 // a collection of threats. used to store threats which combined may result in a new threat
 typedef struct ThreatCollection
 {
-  Threat *threats[4];
+  int threats[4];  // the indices of the threats
   int threat_count;
   int d;
 } ThreatCollection;
 
-static Threat **threats;  // array of all found threats
-static int threats_size;  // size of `threats`
-static int threat_count;  // number of found threats
-static int done;  // whether we should stop the search
-static int combination_stage;  // the number of combination stages used
-static int *moves_before;  // the state of the game at the start of the computation
-static List list;
+struct CombineStage;
+
+// a thread that runs part of a combination stage, namely the combinations of which the threat with the highest index is between `min_index` and `max_index`. it works on a private copy of the board and of the threats found before the stage
+typedef struct CombineWorker
+{
+  Thread thread;
+  Engine engine;
+  struct CombineStage *stage;
+  int index;
+  int min_index, max_index;
+  volatile int stop;  // set when a worker with a lower index found a possibly winning threat sequence, so the threats of this worker are not needed
+  int success;  // whether the worker found a possibly winning threat sequence, which is then stored in `result`
+  int out_of_time;
+  TssResult result;
+  Threat *new_threats;  // the threats found by the worker, with the indices of the worker
+  int new_threat_count;
+} CombineWorker;
+
+// the state of the search at the start of a combination stage that runs on several threads
+typedef struct CombineStage
+{
+  CombineWorker *workers;
+  int worker_count;
+  const Threat *threats;
+  int threat_count;
+  const ullong *ancestor_bits;
+  int ancestor_bits_length;
+  int combination_stage;
+  int mark_before;
+  float stop_time;
+} CombineStage;
+
+// a check of `find_safe_move` whether candidate move `v` is safe. it runs on the calling thread, or on a probe worker
+typedef struct SafetyProbe
+{
+  int v;  // the candidate move, or 0 if the worker has no candidate in the current round
+  int rank;  // the index of the candidate in the current round, where the best ranked candidate has index 0
+  volatile int stop;  // set when a better ranked candidate turned out to be safe, so the result of this probe is not needed
+  float stop_time;
+  int safe;
+  int out_of_time;
+  TssResult result;  // the possibly winning threat sequence of the opponent after `v`, if there is one
+} SafetyProbe;
+
+// a thread that probes the candidates of `find_safe_move` on a private copy of the game. the workers are started by the first search of a game that needs them and run until the end of the game. before each probe a worker brings its copy to the position of the search with `board_follow`, which only replays the moves made since its last probe
+typedef struct ProbeWorker
+{
+  Thread thread;
+  Engine engine;  // the copy of the game that the worker starts from
+  SafetyProbe probe;
+} ProbeWorker;
+
+// the probe workers and the rounds of probes that they run together with the thread of `find_safe_move`
+typedef struct ProbePool
+{
+  ProbeWorker *workers;  // the `threads - 1` workers, or 0 if they were not started
+  Mutex mutex;
+  Cond start;  // broadcast when a round starts or when the workers should quit
+  Cond finish;  // broadcast when the last worker finished the current round
+  int round;  // the number of rounds started so far
+  int pending;  // the number of workers that did not finish the current round yet
+  int quit;
+  SafetyProbe **probes;  // the probes of the current round in order of rank
+  int probe_count;
+  int *history;  // the moves of the game in the position of the current round
+  int history_length;
+  char pid, active_id;
+  int active_turn;
+} ProbePool;
+
+static thread_local_ Threat *threats;  // the threats found by the current search, where threat `t` is stored at `threats[t]`. the array is kept for the next searches of the thread and only grows, so a search allocates nothing unless it finds more threats than any earlier search
+static thread_local_ int threats_size;  // size of `threats`
+static thread_local_ int threat_count;  // number of found threats
+static thread_local_ ullong *ancestor_bits;  // the bitsets of the dependency graphs of the threats in `threats`
+static thread_local_ int ancestor_bits_size;  // size of `ancestor_bits`
+static thread_local_ int ancestor_bits_length;  // the number of words of `ancestor_bits` used by the threats in `threats`
+static thread_local_ int *conflict_marks;  // `conflict_marks[v] == conflict_stamp` if `v` is a gain or cost vector of a threat in the dependency graph loaded by `possible_valid_combination`, and `conflict_marks[v] == conflict_stamp - 1` if it is only an end vector of such a threat. so the marks are cleared by increasing `conflict_stamp`
+static thread_local_ int conflict_stamp;
+static thread_local_ int done;  // whether we should stop the search
+static thread_local_ int combination_stage;  // the number of combination stages used
+static thread_local_ int mark_before;  // checkpoint of the state of the game at the start of the computation
+static thread_local_ List replay;  // used by `check_wts` to restore the state of the game
+static thread_local_ List list;
+static const ullong cache_key = 0x9b05688c2b3e6c1fULL;  // part of the cache key of the searches of `tss`
+static ProbePool pool;
 
 static int create_threats(ThreatCollection *);
 
 void file_tss_ini()
 {
-  list_ini(&list, 9);
+  pool.workers = 0;
+  file_tss_thread_ini();
 }
 
+static void stop_probe_workers();
+
 void file_tss_cleanup()
+{
+  stop_probe_workers();
+  file_tss_thread_cleanup();
+}
+
+// allocates the data structures that every thread needs for the search
+void file_tss_thread_ini()
+{
+  list_ini(&list, 9);
+  list_ini(&replay, 9);
+  threats_size = 64;
+  threats = (Threat *)malloc_safe(threats_size * sizeof(Threat));
+  ancestor_bits_size = 256;
+  ancestor_bits = (ullong *)malloc_safe(ancestor_bits_size * sizeof(ullong));
+  conflict_marks = (int *)calloc_safe(size, sizeof(int));
+  conflict_stamp = 0;
+}
+
+void file_tss_thread_cleanup()
 {
   list_cleanup(&list);
+  list_cleanup(&replay);
+  free(threats);
+  free(ancestor_bits);
+  free(conflict_marks);
 }
 
-// stores the indices of all threats in the dependency graph of `t` in ascending order in `list`
-// if `update_conflict_board` is set then it also keeps track of all the gain and cost and end vectors of the threats in the dependency graph, and stores this information in `conflict_board`
-static void load_dependency_graph(Threat *t, int update_conflict_board)
+// makes sure that `ancestor_bits` has room for `words` more words
+static void reserve_ancestor_bits(int words)
 {
-  int k;
-  list_ordered_add(&list, t->index);
-  if (update_conflict_board == 1)
+  while (ancestor_bits_length + words > ancestor_bits_size)
   {
-    conflict_board[t->gv] = 1;
-    for (k = 0; k < t->cv_count; k++)
-    {
-      conflict_board[t->cvs[k]] = 1;
-    }
-    for (k = 0; k < t->ev_count; k++)
+    ancestor_bits_size *= 2;
+    ancestor_bits = (ullong *)realloc_safe(ancestor_bits, ancestor_bits_size * sizeof(ullong));
+  }
+}
+
+// returns whether threat `t` is in the dependency graph of threat `u`
+static int is_ancestor(int t, int u)
+{
+  return t <= u && ancestor_bits[threats[u].ancestors + t / 64] >> (t & 63) & 1;
+}
+
+// stores the indices of all threats in the dependency graphs of the `count` threats `ts` in ascending order in `list`
+static void load_dependency_graphs(const int *ts, int count)
+{
+  int i, k, words;
+  ullong x, *bits, *row;
+  words = 0;
+  for (k = 0; k < count; k++)
+  {
+    words = max_(words, ts[k] / 64 + 1);
+  }
+  // the union of the graphs is built in the unused part of `ancestor_bits`
+  reserve_ancestor_bits(words);
+  bits = ancestor_bits + ancestor_bits_length;
+  memset(bits, 0, words * sizeof(ullong));
+  for (k = 0; k < count; k++)
+  {
+    row = ancestor_bits + threats[ts[k]].ancestors;
+    for (i = 0; i <= ts[k] / 64; i++)
     {
-      conflict_board[t->evs[k]] = 2;
+      bits[i] |= row[i];
     }
   }
-  for (k = 0; k < t->parent_count; k++)
+  list_clear(&list);
+  for (i = 0; i < words; i++)
   {
-    if (!list_contains(&list, t->parent_threats[k]->index))
+    for (x = bits[i]; x; x &= x - 1)
     {
-      load_dependency_graph(t->parent_threats[k], update_conflict_board);
+      list_add(&list, 64 * i + ctz64(x));
     }
   }
 }
@@ -129,7 +256,7 @@ static void handle_wts(int v)
   result.threats = (ResultThreat *)malloc_safe(sizeof(ResultThreat) * result.threat_count);
   for (k = 0; k < list.length; k++)
   {
-    t = threats[list.values[k]];
+    t = &threats[list.values[k]];
     result.threats[k].gv = t->gv;
     result.threats[k].cv_count = t->cv_count;
     for (l = 0; l < t->cv_count; l++)
@@ -147,7 +274,8 @@ static void handle_wts(int v)
 // `v` is the move that should win the game after the threat sequence is finished
 static int check_wts()
 {
-  int k, v, i, u, success, *backup;
+  int k, v, i, u, success, mark;
+  ullong key;
   Threat *t;
   for (u = v0; u < v1; u++)
   {
@@ -155,23 +283,39 @@ static int check_wts()
   }
   for (k = 0; k < list.length; k++)
   {
-    t = threats[list.values[k]];
+    t = &threats[list.values[k]];
     if (t->ev_count)
     {
       win_board[t->evs[0]] = 1;
       win_board[t->evs[1]] = 1;
     }
   }
-  backup = copy_moves();
+  // the outcome of `tss_counter` depends on the squares of `win_board`, so they are part of its cache key
+  key = 0;
+  for (u = v0; u < v1; u++)
+  {
+    if (win_board[u] == 1 || win_board[u] == 2)
+    {
+      key ^= zobrist[4 * u];
+    }
+  }
+  // the moves made since the start of the computation are kept in `replay`, as they are overwritten by the moves of the threat sequence
+  mark = board_mark();
+  list_clear(&replay);
+  for (k = mark_before; k < mark; k++)
+  {
+    list_add(&replay, moves[k]);
+  }
   for (i = 0; i < p->fives.length; i++)
   {
     v = p->fives.values[i];
     win_board[v] = 1;
-    restore_moves(moves_before);
+    win_board_key = key ^ zobrist[4 * v];
+    board_rollback(mark_before);
     success = 1;
     for (k = 0; k < list.length; k++)
     {
-      t = threats[list.values[k]];
+      t = &threats[list.values[k]];
       submit_move(t->gv);
       if (t->cv_count >= 2)
       {
@@ -198,24 +342,34 @@ static int check_wts()
     handle_wts(v);
     done = 1;
   }
-  restore_moves(backup);
-  free(backup);
+  for (k = 0; k < replay.length && mark_before + k < turn; k++)
+  {
+    if (moves[mark_before + k] != replay.values[k])
+    {
+      break;
+    }
+  }
+  board_rollback(mark_before + k);
+  for (; k < replay.length; k++)
+  {
+    set_p(replay.values[k] > 0 ? 1 : 2);
+    submit_move(abs(replay.values[k]));
+  }
   return done;
 }
 
-// checks whether `t` is the final threat in a winning threat sequence
+// checks whether threat `t` is the final threat in a winning threat sequence
 // otherwise tries to create other threats that depend on `t`
-static void handle_new_threat(Threat *t)
+static void handle_new_threat(int t)
 {
   ThreatCollection col;
-  submit_move(t->gv);
+  submit_move(threats[t].gv);
   if (!win_in_3(pid))
   {
-    submit_moves(t->cv_count, t->cvs);
+    submit_moves(threats[t].cv_count, threats[t].cvs);
     if (p->fives.length)
     {
-      list_clear(&list);
-      load_dependency_graph(t, 0);
+      load_dependency_graphs(&t, 1);
       check_wts();
     }
     else if (q->fives.length <= 1)
@@ -224,30 +378,60 @@ static void handle_new_threat(Threat *t)
       col.threats[0] = t;
       create_threats(&col);
     }
-    undo_moves(t->cv_count);
+    // `create_threats` may have moved `threats`
+    undo_moves(threats[t].cv_count);
   }
   undo_move();
 }
 
+// makes room in `threats` for one more threat
+static void reserve_threat()
+{
+  if (threat_count >= threats_size)
+  {
+    threats_size *= 2;
+    threats = (Threat *)realloc_safe(threats, threats_size * sizeof(Threat));
+  }
+}
+
+// stores the dependency graph of the new threat `threats[threat_count]`, which is the union of the graphs of its parents plus the threat itself, at the end of `ancestor_bits`
+static void add_ancestors()
+{
+  int k, i, words;
+  ullong *row, *parent_row;
+  Threat *t;
+  t = &threats[threat_count];
+  words = threat_count / 64 + 1;
+  reserve_ancestor_bits(words);
+  t->ancestors = ancestor_bits_length;
+  ancestor_bits_length += words;
+  row = ancestor_bits + t->ancestors;
+  memset(row, 0, words * sizeof(ullong));
+  for (k = 0; k < t->parent_count; k++)
+  {
+    parent_row = ancestor_bits + threats[t->parent_threats[k]].ancestors;
+    for (i = 0; i <= t->parent_threats[k] / 64; i++)
+    {
+      row[i] |= parent_row[i];
+    }
+  }
+  row[threat_count / 64] |= 1ULL << (threat_count & 63);
+}
+
 // creates a new threat that depends on all threats in `col`
 static void create_threat(ThreatCollection *col, int gv, int cv_count, int ev_count, ...)
 {
   va_list ap;
   int k;
   Threat *t;
-  t = (Threat *)calloc_safe(1, sizeof(Threat));
-  if (threat_count >= threats_size)
-  {
-    threats_size = max_(threats_size * 2, 8);
-    threats = (Threat **)realloc_safe(threats, threats_size * sizeof(Threat *));
-  }
-  t->index = threat_count++;
-  threats[t->index] = t;
+  reserve_threat();
+  t = &threats[threat_count];
   t->parent_count = col->threat_count;
   for (k = 0; k < col->threat_count; k++)
   {
     t->parent_threats[k] = col->threats[k];
   }
+  add_ancestors();
   t->gv = gv;
   t->cv_count = cv_count;
   t->ev_count = ev_count;
@@ -261,7 +445,7 @@ static void create_threat(ThreatCollection *col, int gv, int cv_count, int ev_co
     t->evs[k] = va_arg(ap, int);
   }
   va_end(ap);
-  handle_new_threat(t);
+  handle_new_threat(threat_count++);
 }
 
 // creates new threats with gain vector `v` in the direction `d` that depend on all the threats in `col`
@@ -270,32 +454,22 @@ static void create_threat(ThreatCollection *col, int gv, int cv_count, int ev_co
 static int create_threats_at(ThreatCollection *col, int v, int d, int rightmin, int leftmin)
 {
   int a, b, x, y, z;
-  int left, right, ll, rr;
+  int left, right, ll, rr, right_empty, left_empty;
+  LineWindow lw;
   if (q->fives.length && q->fives.values[0] != v)
   {
     return 0;
   }
-  a = tail_length(v, d, pid);
-  b = tail_length(v, -d, pid);
+  load_window(&lw, v, d, pid);
+  a = window_run(lw.own[0], lw.up[0], 0);
+  b = window_run(lw.own[1], lw.up[1], 0);
   x = 1 + a + b;
   right = v + (a + 1) * d;
   left = v - (b + 1) * d;
-  if (!board[right])
-  {
-    y = min_(1 + tail_length(right, d, pid), n - x);
-  }
-  else
-  {
-    y = 0;
-  }
-  if (!board[left])
-  {
-    z = min_(1 + tail_length(left, -d, pid), n - x);
-  }
-  else
-  {
-    z = 0;
-  }
+  right_empty = window_test(lw.empty[0], lw.up[0], a);
+  left_empty = window_test(lw.empty[1], lw.up[1], b);
+  y = right_empty ? min_(1 + window_run(lw.own[0], lw.up[0], a + 1), n - x) : 0;
+  z = left_empty ? min_(1 + window_run(lw.own[1], lw.up[1], b + 1), n - x) : 0;
   if (a + y < rightmin || b + z < leftmin)
   {
     return 0;
@@ -308,12 +482,12 @@ static int create_threats_at(ThreatCollection *col, int v, int d, int rightmin,
   {
     create_threat(col, v, 1, 0, left);
   }
-  if (!board[right] && !board[left] && x + y < n && x + z < n
+  if (right_empty && left_empty && x + y < n && x + z < n
     && (x + y == n - 1 || x + z == n - 1))
   {
     rr = v + (a + y + 1) * d;
     ll = v - (b + z + 1) * d;
-    if (x + y == n - 1 && !board[rr])
+    if (x + y == n - 1 && window_test(lw.empty[0], lw.up[0], a + y))
     {
       y++;
     }
@@ -321,7 +495,7 @@ static int create_threats_at(ThreatCollection *col, int v, int d, int rightmin,
     {
       y = 1;
     }
-    if (x + z == n - 1 && !board[ll])
+    if (x + z == n - 1 && window_test(lw.empty[1], lw.up[1], b + z))
     {
       z++;
     }
@@ -392,12 +566,8 @@ static int create_threats(ThreatCollection *col)
   }
   if (!col->threat_count)
   {
-    for (v = v0; v < v1; v++)
+    for (v = first_candidate(); v; v = next_candidate(v))
     {
-      if (board[v] || !nearby[v])
-      {
-        continue;
-      }
       if (create_threats_at(col, v, 1, 0, 0) ||
         create_threats_at(col, v, w, 0, 0) ||
         create_threats_at(col, v, se, 0, 0) ||
@@ -409,7 +579,7 @@ static int create_threats(ThreatCollection *col)
   }
   else if (col->threat_count == 1)
   {
-    v = col->threats[0]->gv;
+    v = threats[col->threats[0]].gv;
     if (create_threats_tail(col, v, 1, 0, 0) ||
       create_threats_tail(col, v, -1, 0, 0) ||
       create_threats_tail(col, v, w, 0, 0) ||
@@ -424,12 +594,12 @@ static int create_threats(ThreatCollection *col)
   }
   else
   {
-    v = col->threats[0]->gv;
+    v = threats[col->threats[0]].gv;
     leftmin = 0;
     rightmin = 0;
     for (k = 1; k < col->threat_count; k++)
     {
-      x = (col->threats[k]->gv - v) / col->d;
+      x = (threats[col->threats[k]].gv - v) / col->d;
       leftmin = max_(leftmin, -x);
       rightmin = max_(rightmin, x);
     }
@@ -439,72 +609,102 @@ static int create_threats(ThreatCollection *col)
   return 0;
 }
 
-// checks whether a threat in the dependency graph of `t` is in conflict with a threat in `list` (this is done indirectly by using `conflict_board`)
-static int conflicting_dependency_graph(Threat *t)
+// marks the gain and cost vectors and the end vectors of threat `t` in `conflict_marks`
+static void mark_threat(Threat *t)
 {
   int k;
-  list_ordered_add(&list, t->index);
-  if (conflict_board[t->gv])
+  conflict_marks[t->gv] = conflict_stamp;
+  for (k = 0; k < t->cv_count; k++)
   {
-    return 1;
+    conflict_marks[t->cvs[k]] = conflict_stamp;
   }
-  for (k = 0; k < t->cv_count; k++)
+  for (k = 0; k < t->ev_count; k++)
   {
-    if (conflict_board[t->cvs[k]])
+    if (conflict_marks[t->evs[k]] != conflict_stamp)
     {
-      return 1;
+      conflict_marks[t->evs[k]] = conflict_stamp - 1;
     }
   }
-  for (k = 0; k < t->ev_count; k++)
+}
+
+// checks whether threat `t` is in conflict with a threat marked in `conflict_marks`
+static int conflicting_threat(Threat *t)
+{
+  int k;
+  if (conflict_marks[t->gv] >= conflict_stamp - 1)
+  {
+    return 1;
+  }
+  for (k = 0; k < t->cv_count; k++)
   {
-    if (conflict_board[t->evs[k]] == 1)
+    if (conflict_marks[t->cvs[k]] >= conflict_stamp - 1)
     {
       return 1;
     }
   }
-  for (k = 0; k < t->parent_count; k++)
+  for (k = 0; k < t->ev_count; k++)
   {
-    if (!list_ordered_contains(&list, t->parent_threats[k]->index))
+    if (conflict_marks[t->evs[k]] == conflict_stamp)
     {
-      if (conflicting_dependency_graph(t->parent_threats[k]))
-      {
-        return 1;
-      }
+      return 1;
     }
   }
   return 0;
 }
 
 // checks whether it may be possible to play both the threat sequences of `t1` and `t2`, and that one is not a subsequence of the other
-// this is done by checking whether the dependency graphs of `t1` and `t2` do not contain conflicting threats
-static int possible_valid_combination(Threat *t1, Threat *t2)
+// this is done by checking whether the dependency graphs of `t1` and `t2` do not contain conflicting threats. the threats that are in both graphs are not checked
+static int possible_valid_combination(int t1, int t2)
 {
-  Threat *swap;
+  int swap, i;
+  ullong x, *row1, *row2;
   // after this swap we know for sure that the threat sequence of `t1` is not a subsequence of the threat sequence of `t2`, as `t1` is not in the dependency tree of `t2`, which follows from the fact that `t1` is found after `t2`
-  if (t2->index > t1->index)
+  if (t2 > t1)
   {
     swap = t2;
     t2 = t1;
     t1 = swap;
   }
-  board_clear(conflict_board);
-  list_clear(&list);
-  load_dependency_graph(t1, 1);  // add all threats in the dependency graph of `t1` to `list`, and updates `conflict_board`
   // check whether `t2` is a subsequence of `t1`
-  if (list_contains(&list, t2->index))
+  if (is_ancestor(t2, t1))
   {
     return 0;
   }
-  return !conflicting_dependency_graph(t2);
+  if (conflict_stamp >= INT_MAX - 2)
+  {
+    memset(conflict_marks, 0, size * sizeof(int));
+    conflict_stamp = 0;
+  }
+  conflict_stamp += 2;
+  row1 = ancestor_bits + threats[t1].ancestors;
+  row2 = ancestor_bits + threats[t2].ancestors;
+  for (i = 0; i <= t1 / 64; i++)
+  {
+    for (x = row1[i]; x; x &= x - 1)
+    {
+      mark_threat(&threats[64 * i + ctz64(x)]);
+    }
+  }
+  for (i = 0; i <= t2 / 64; i++)
+  {
+    for (x = row2[i] & ~row1[i]; x; x &= x - 1)
+    {
+      if (conflicting_threat(&threats[64 * i + ctz64(x)]))
+      {
+        return 0;
+      }
+    }
+  }
+  return 1;
 }
 
 // tries to add `t` to `col` and returns whether this was successful
-static int add_threat(ThreatCollection *col, Threat *t)
+static int add_threat(ThreatCollection *col, int t)
 {
   int k, d, v;
   if (col->threat_count)
   {
-    d = get_d(col->threats[0]->gv, t->gv);
+    d = get_d(threats[col->threats[0]].gv, threats[t].gv);
     if (!d)
     {
       return 0;
@@ -517,14 +717,14 @@ static int add_threat(ThreatCollection *col, Threat *t)
       }
       for (k = 1; k < col->threat_count; k++)
       {
-        if (!get_d(col->threats[k]->gv, t->gv))
+        if (!get_d(threats[col->threats[k]].gv, threats[t].gv))
         {
           return 0;
         }
       }
     }
-    v = col->threats[0]->gv + d;
-    while (v != t->gv)
+    v = threats[col->threats[0]].gv + d;
+    while (v != threats[t].gv)
     {
       if (board[v] && board[v] != pid)
       {
@@ -553,14 +753,10 @@ static int do_all_moves(ThreatCollection *col)
 {
   int k;
   Threat *t;
-  list_clear(&list);
-  for (k = 0; k < col->threat_count; k++)
-  {
-    load_dependency_graph(col->threats[k], 0);
-  }
+  load_dependency_graphs(col->threats, col->threat_count);
   for (k = 0; k < list.length; k++)
   {
-    t = threats[list.values[k]];
+    t = &threats[list.values[k]];
     submit_move(t->gv);
     if (p->fives.length || win_in_3(pid))
     {
@@ -584,22 +780,19 @@ static int do_all_moves(ThreatCollection *col)
 // tries to make new threats by combining two or three threats
 static int combine(int min_index, int max_index, ThreatCollection *col)
 {
-  Threat *t;
-  int k, *backup;
+  int k, mark;
   for (k = max_index; k >= min_index; k--)
   {
-    t = threats[k];
-    if (add_threat(col, t))
+    if (add_threat(col, k))
     {
       if (col->threat_count >= 2)
       {
-        backup = copy_moves();
+        mark = board_mark();
         if (do_all_moves(col))
         {
           create_threats(col);
         }
-        restore_moves(backup);
-        free(backup);
+        board_rollback(mark);
       }
       if (!done && col->threat_count < 3)
       {
@@ -615,15 +808,143 @@ static int combine(int min_index, int max_index, ThreatCollection *col)
   return 0;
 }
 
-static void cleanup()
+static void run_combine_worker(void *arg)
 {
+  CombineWorker *worker;
+  CombineStage *stage;
+  ThreatCollection col;
   int k;
-  for (k = 0; k < threat_count; k++)
+  worker = (CombineWorker *)arg;
+  stage = worker->stage;
+  engine_load(&worker->engine);
+  engine_thread_ini();
+  stop_signal = &worker->stop;
+  set_time_limit(stage->stop_time - get_time());
+  while (threats_size < stage->threat_count)
+  {
+    threats_size *= 2;
+  }
+  threats = (Threat *)realloc_safe(threats, threats_size * sizeof(Threat));
+  memcpy(threats, stage->threats, stage->threat_count * sizeof(Threat));
+  threat_count = stage->threat_count;
+  ancestor_bits_length = 0;
+  reserve_ancestor_bits(stage->ancestor_bits_length);
+  memcpy(ancestor_bits, stage->ancestor_bits, stage->ancestor_bits_length * sizeof(ullong));
+  ancestor_bits_length = stage->ancestor_bits_length;
+  done = 0;
+  combination_stage = stage->combination_stage;
+  mark_before = stage->mark_before;
+  result.success = 0;
+  result.only_fours = 0;
+  col.threat_count = 0;
+  combine(worker->min_index, worker->max_index, &col);
+  worker->success = result.success;
+  worker->out_of_time = out_of_time;
+  worker->result = result;
+  if (worker->success)
+  {
+    // the later workers combine threats of lower indices, so their results come after this one in the sequential order
+    for (k = worker->index + 1; k < stage->worker_count; k++)
+    {
+      stage->workers[k].stop = 1;
+    }
+  }
+  worker->new_threat_count = threat_count - stage->threat_count;
+  worker->new_threats = (Threat *)malloc_safe(max_(worker->new_threat_count, 1) * sizeof(Threat));
+  memcpy(worker->new_threats, threats + stage->threat_count, worker->new_threat_count * sizeof(Threat));
+  engine_thread_cleanup();
+  engine_save(&worker->engine);
+  engine_free(&worker->engine);
+}
+
+// runs `combine(min_index, max_index, col)` with an empty `col` on `threads` threads, and returns whether the search is done
+// the range of indices is split into consecutive parts, and the new threats of the parts are appended in order of decreasing index, so the threats and the result are the same as those of the sequential stage
+static int combine_parallel(int min_index, int max_index)
+{
+  CombineStage stage;
+  CombineWorker *worker;
+  ullong total, weight, part;
+  int i, k, l, m, base;
+  stage.worker_count = min_(threads, max_index - min_index + 1);
+  stage.workers = (CombineWorker *)calloc_safe(stage.worker_count, sizeof(CombineWorker));
+  stage.threats = threats;
+  stage.threat_count = threat_count;
+  stage.ancestor_bits = ancestor_bits;
+  stage.ancestor_bits_length = ancestor_bits_length;
+  stage.combination_stage = combination_stage;
+  stage.mark_before = mark_before;
+  stage.stop_time = stop_time;
+  // the combinations of threat `k` are made with the threats of lower indices, so the work of `k` grows about quadratically with `k`
+  total = 0;
+  for (k = min_index; k <= max_index; k++)
+  {
+    total += (ullong)(k + 1) * (k + 1);
+  }
+  k = max_index;
+  weight = 0;
+  for (i = 0; i < stage.worker_count; i++)
+  {
+    worker = &stage.workers[i];
+    worker->stage = &stage;
+    worker->index = i;
+    worker->max_index = k;
+    part = total * (i + 1) / stage.worker_count;
+    // every worker gets at least one index, and leaves at least one for each of the next workers
+    do
+    {
+      weight += (ullong)(k + 1) * (k + 1);
+      k--;
+    } while (weight < part && k >= min_index + stage.worker_count - i - 1);
+    worker->min_index = i == stage.worker_count - 1 ? min_index : k + 1;
+    engine_copy(&worker->engine);
+  }
+  for (i = 0; i < stage.worker_count; i++)
   {
-    free(threats[k]);
+    thread_start(&stage.workers[i].thread, run_combine_worker, &stage.workers[i]);
   }
-  free(threats);
-  free(moves_before);
+  for (i = 0; i < stage.worker_count; i++)
+  {
+    thread_join(&stage.workers[i].thread);
+  }
+  for (i = 0; i < stage.worker_count; i++)
+  {
+    worker = &stage.workers[i];
+    if (!done)
+    {
+      base = threat_count;
+      for (l = 0; l < worker->new_threat_count; l++)
+      {
+        reserve_threat();
+        threats[threat_count] = worker->new_threats[l];
+        for (m = 0; m < threats[threat_count].parent_count; m++)
+        {
+          if (threats[threat_count].parent_threats[m] >= stage.threat_count)
+          {
+            threats[threat_count].parent_threats[m] += base - stage.threat_count;
+          }
+        }
+        add_ancestors();
+        threat_count++;
+      }
+      if (worker->success)
+      {
+        result = worker->result;
+        done = 1;
+      }
+      else if (worker->out_of_time)
+      {
+        out_of_time = 1;
+        done = 1;
+      }
+    }
+    else if (worker->success)
+    {
+      free(worker->result.threats);
+    }
+    free(worker->new_threats);
+  }
+  free(stage.workers);
+  return done;
 }
 
 // searches for a possibly winning threat sequence. returns whether successful. additional information will be written to `result`
@@ -631,37 +952,58 @@ static void cleanup()
 int tss(char id)
 {
   ThreatCollection col;
-  int threat_count_before, prev_threat_count;
+  int threat_count_before, prev_threat_count, extended;
   char pid_before;
+  ullong key;
   if (active_player->only_fours || win_in_3(id))
   {
     return tss_fours(id);
   }
+  key = tss_cache_key(id, cache_key);
+  if (tss_cache_probe(key, &result))
+  {
+    return result.success;
+  }
   pid_before = set_p(id);
   threat_count = 0;
+  ancestor_bits_length = 0;
   done = 0;
-  threats = 0;
-  threats_size = 0;
   combination_stage = 0;
-  moves_before = copy_moves();
+  mark_before = board_mark();
   result.success = 0;
   result.only_fours = 0;
   col.threat_count = 0;
   prev_threat_count = 0;
+  extended = 0;
   if (!create_threats(&col) && allow_combinations)
   {
     do
     {
       threat_count_before = threat_count;
       combination_stage++;
-      if (combine(prev_threat_count, threat_count - 1, &col))
+      // only the search of the current position is worth the cost of starting the threads. the searches of the helper threads have a `stop_signal`
+      if (threads > 1 && !stop_signal && turn == active_turn && threat_count - prev_threat_count >= parallel_combine_threats)
+      {
+        if (combine_parallel(prev_threat_count, threat_count - 1))
+          break;
+      }
+      else if (combine(prev_threat_count, threat_count - 1, &col))
         break;
+      // the search of the current position is near completion if the stages find fewer and fewer new threats, so it gets some more time to complete
+      if (!extended && turn == active_turn && threat_count > threat_count_before && threat_count - threat_count_before < threat_count_before - prev_threat_count)
+      {
+        extend_turn(0.25f);
+        extended = 1;
+      }
       prev_threat_count = threat_count_before;
     } while (threat_count_before != threat_count);
   }
-  cleanup();
   set_p(pid_before);
   //temp print_("tss stats: %d threats, %d stages", threat_count, combination_stage);
+  if (!out_of_time)
+  {
+    tss_cache_store(key, &result);
+  }
   return result.success;
 }
 
@@ -721,12 +1063,149 @@ int is_safe_move(int v)
   return safe;
 }
 
+static void probe_safety(SafetyProbe *probe)
+{
+  submit_move(probe->v);
+  probe->safe = !tss_quiescence(pid);
+  undo_move();
+  probe->out_of_time = out_of_time;
+  probe->result = result;
+}
+
+static void run_probe_worker(void *arg)
+{
+  ProbeWorker *worker;
+  SafetyProbe *probe;
+  int round, k;
+  worker = (ProbeWorker *)arg;
+  probe = &worker->probe;
+  engine_load(&worker->engine);
+  engine_thread_ini();
+  stop_signal = &probe->stop;
+  round = 0;
+  while (1)
+  {
+    mutex_lock(&pool.mutex);
+    while (pool.round == round && !pool.quit)
+    {
+      cond_wait(&pool.start, &pool.mutex);
+    }
+    round = pool.round;
+    mutex_unlock(&pool.mutex);
+    if (pool.quit)
+    {
+      break;
+    }
+    if (probe->v)
+    {
+      board_follow(pool.history, pool.history_length);
+      set_p(pool.pid);
+      active_id = pool.active_id;
+      active_turn = pool.active_turn;
+      active_player = &players[active_id - 1];
+      set_time_limit(probe->stop_time - get_time());
+      probe_safety(probe);
+      if (probe->safe || probe->out_of_time)
+      {
+        for (k = probe->rank + 1; k < pool.probe_count; k++)
+        {
+          pool.probes[k]->stop = 1;
+        }
+      }
+    }
+    mutex_lock(&pool.mutex);
+    pool.pending--;
+    if (!pool.pending)
+    {
+      cond_broadcast(&pool.finish);
+    }
+    mutex_unlock(&pool.mutex);
+  }
+  engine_thread_cleanup();
+  engine_save(&worker->engine);
+  engine_free(&worker->engine);
+}
+
+// starts the `threads - 1` probe workers with a copy of the current game
+static void start_probe_workers()
+{
+  int i;
+  pool.workers = (ProbeWorker *)calloc_safe(threads - 1, sizeof(ProbeWorker));
+  pool.history = (int *)malloc_safe(size * sizeof(int));
+  pool.round = 0;
+  pool.quit = 0;
+  mutex_ini(&pool.mutex);
+  cond_ini(&pool.start);
+  cond_ini(&pool.finish);
+  for (i = 0; i < threads - 1; i++)
+  {
+    engine_copy(&pool.workers[i].engine);
+    thread_start(&pool.workers[i].thread, run_probe_worker, &pool.workers[i]);
+  }
+}
+
+static void stop_probe_workers()
+{
+  int i;
+  if (!pool.workers)
+  {
+    return;
+  }
+  mutex_lock(&pool.mutex);
+  pool.quit = 1;
+  cond_broadcast(&pool.start);
+  mutex_unlock(&pool.mutex);
+  for (i = 0; i < threads - 1; i++)
+  {
+    thread_join(&pool.workers[i].thread);
+  }
+  mutex_cleanup(&pool.mutex);
+  cond_cleanup(&pool.start);
+  cond_cleanup(&pool.finish);
+  free(pool.workers);
+  free(pool.history);
+  pool.workers = 0;
+}
+
+// probes the candidates of `probes` at the same time, where `probes[0]` is probed by the calling thread and the other probes by the workers
+static void run_probe_round(SafetyProbe **probes, int count)
+{
+  int k;
+  mutex_lock(&pool.mutex);
+  memcpy(pool.history, moves, turn * sizeof(int));
+  pool.history_length = turn;
+  pool.pid = pid;
+  pool.active_id = active_id;
+  pool.active_turn = active_turn;
+  pool.probes = probes;
+  pool.probe_count = count;
+  pool.pending = threads - 1;
+  pool.round++;
+  cond_broadcast(&pool.start);
+  mutex_unlock(&pool.mutex);
+  probe_safety(probes[0]);
+  if (probes[0]->safe || out_of_time)
+  {
+    for (k = 1; k < count; k++)
+    {
+      probes[k]->stop = 1;
+    }
+  }
+  mutex_lock(&pool.mutex);
+  while (pool.pending)
+  {
+    cond_wait(&pool.finish, &pool.mutex);
+  }
+  mutex_unlock(&pool.mutex);
+}
+
 // returns a safe move for player `pid`, or -1 if all moves are safe
 // assumes there is no win within 2 moves
 static int find_safe_move(char *safeties)
 {
-  int v, u, ans;
+  int v, u, i, count, max_probes, ans;
   float *scores, best;
+  SafetyProbe own_probe, **probes;
   if (!tss(qid))
   {
     return -1;
@@ -738,37 +1217,85 @@ static int find_safe_move(char *safeties)
     scores[v] = nearby[v] ? -size : -FLT_MAX;
   }
   handle_tss_results(scores);
+  // with several threads the best `threads` candidates are probed at the same time, by this thread and the probe workers. the results are handled in order of rank, so the answer is the best ranked candidate of the round that is safe, and of which all better ranked candidates are unsafe
+  // the candidates of a round are ranked before their refutations are known, so unlike with a single thread a refutation only changes the ranking of the next round. the answer may then differ from that with a single thread, but it is still safe. the searches of the helper threads have a `stop_signal` and probe one candidate at a time
+  max_probes = stop_signal ? 1 : threads;
+  probes = (SafetyProbe **)malloc_safe(max_probes * sizeof(SafetyProbe *));
+  if (max_probes > 1 && !pool.workers)
+  {
+    start_probe_workers();
+  }
+  probes[0] = &own_probe;
+  for (i = 1; i < max_probes; i++)
+  {
+    probes[i] = &pool.workers[i - 1].probe;
+  }
   u = 0;
   ans = 0;
-  while (1)
+  while (!ans && !out_of_time)
   {
-    best = -FLT_MAX;
-    for (v = v0; v < v1; v++)
+    for (count = 0; count < max_probes; count++)
     {
-      if (safeties[v] == 2 && scores[v] > best)
+      best = -FLT_MAX;
+      for (v = v0; v < v1; v++)
       {
-        best = scores[v];
-        u = v;
+        if (safeties[v] == 2 && scores[v] > best)
+        {
+          best = scores[v];
+          u = v;
+        }
       }
+      if (best == -FLT_MAX)
+      {
+        break;
+      }
+      // excludes `u` from the remaining choices of this round
+      safeties[u] = 3;
+      probes[count]->v = u;
     }
-    if (best == -FLT_MAX)
+    if (!count)
     {
       break;
     }
-    submit_move(u);
-    safeties[u] = !tss_quiescence(pid);
-    undo_move();
-    if (out_of_time)
+    if (count == 1)
     {
-      break;
+      probe_safety(probes[0]);
     }
-    if (safeties[u])
+    else
     {
-      ans = u;
-      break;
+      for (i = 0; i < max_probes; i++)
+      {
+        probes[i]->v = i < count ? probes[i]->v : 0;
+        probes[i]->rank = i;
+        probes[i]->stop = 0;
+        probes[i]->stop_time = stop_time;
+      }
+      run_probe_round(probes, count);
+    }
+    for (i = 0; i < count; i++)
+    {
+      if (ans || out_of_time)
+      {
+        // a better ranked candidate already ended the search, so this probe was stopped
+        safeties[probes[i]->v] = 2;
+      }
+      else
+      {
+        safeties[probes[i]->v] = probes[i]->safe;
+        if (probes[i]->out_of_time)
+        {
+          out_of_time = 1;
+        }
+        else if (probes[i]->safe)
+        {
+          ans = probes[i]->v;
+        }
+      }
+      result = probes[i]->result;
+      handle_tss_results(scores);
     }
-    handle_tss_results(scores);
   }
+  free(probes);
   free(scores);
   return ans;
 }
@@ -807,12 +1334,9 @@ static int find_attack()
   int i, v, u;
   List moves;
   list_ini(&moves, empty_squares);
-  for (v = v0; v < v1; v++)
+  for (v = first_candidate(); v; v = next_candidate(v))
   {
-    if (!board[v] && nearby[v])
-    {
-      list_ordered_add_custom(&moves, v, compare_scores);
-    }
+    list_ordered_add_custom(&moves, v, compare_scores);
   }
   u = 0;
   for (i = 0; i < moves.length; i++)
@@ -0,0 +1,109 @@
+// CACHE OF THE THREAT SPACE SEARCHES
+
+// the outcomes of `tss`, `tss_fours` and `tss_counter` are stored by the zobrist key of the position, so a position that is searched again (by a later safety check, or at a later turn) costs a lookup
+// the key also depends on the player for which we search, on the kind of search, and on the settings that change the outcome of the search. a search that ran out of time has an unknown outcome, and is not stored
+// the cache is shared by all threads and kept for the whole game
+
+#include "shared.h"
+
+// an entry of the cache. `result.threats` is owned by the entry
+typedef struct TssCacheEntry
+{
+  ullong key;
+  int used;
+  TssResult result;
+} TssCacheEntry;
+
+int tss_cache_size;  // size of the cache in megabytes
+static TssCacheEntry *cache;  // an array of `cache_mask + 1` entries. a new entry replaces the entry at the same index
+static ullong cache_mask;
+static Mutex cache_mutex;
+static const ullong player_key = 0xbb67ae8584caa73bULL;  // part of the key when we search for player 2
+static const ullong combinations_key = 0x3c6ef372fe94f82bULL;  // part of the key when combinations are allowed
+
+void file_tss_cache_ini()
+{
+  ullong entries;
+  cache = 0;
+  cache_mask = 0;
+  if (tss_cache_size)
+  {
+    entries = 1;
+    while (entries * 2 * sizeof(TssCacheEntry) <= (ullong)tss_cache_size << 20)
+    {
+      entries *= 2;
+    }
+    cache = (TssCacheEntry *)calloc_safe((size_t)entries, sizeof(TssCacheEntry));
+    cache_mask = entries - 1;
+    mutex_ini(&cache_mutex);
+  }
+}
+
+void file_tss_cache_cleanup()
+{
+  ullong i;
+  if (cache)
+  {
+    for (i = 0; i <= cache_mask; i++)
+    {
+      free(cache[i].result.threats);
+    }
+    free(cache);
+    mutex_cleanup(&cache_mutex);
+  }
+}
+
+// returns the key of a search for player `id` in the current position. `mode` is a random constant for each kind of search
+ullong tss_cache_key(char id, ullong mode)
+{
+  return hash ^ mode ^ (id == 2 ? player_key : 0) ^ (allow_combinations ? combinations_key : 0);
+}
+
+// copies `src` to `dest`, including the threat sequence if the search was successful and returned one (`tss_counter` does not)
+static void copy_result(TssResult *dest, const TssResult *src)
+{
+  *dest = *src;
+  dest->threats = 0;
+  if (src->success && src->threats)
+  {
+    dest->threats = (ResultThreat *)malloc_safe(max_(src->threat_count, 1) * sizeof(ResultThreat));
+    memcpy(dest->threats, src->threats, src->threat_count * sizeof(ResultThreat));
+  }
+}
+
+// looks up the search with key `key`. if it is found then its result is written to `r` and we return 1. the caller owns `r->threats`, like after a search
+int tss_cache_probe(ullong key, TssResult *r)
+{
+  TssCacheEntry *entry;
+  int found;
+  if (!cache)
+  {
+    return 0;
+  }
+  entry = &cache[key & cache_mask];
+  mutex_lock(&cache_mutex);
+  found = entry->used && entry->key == key;
+  if (found)
+  {
+    copy_result(r, &entry->result);
+  }
+  mutex_unlock(&cache_mutex);
+  return found;
+}
+
+// stores the result `r` of the search with key `key`
+void tss_cache_store(ullong key, const TssResult *r)
+{
+  TssCacheEntry *entry;
+  if (!cache)
+  {
+    return;
+  }
+  entry = &cache[key & cache_mask];
+  mutex_lock(&cache_mutex);
+  free(entry->result.threats);
+  copy_result(&entry->result, r);
+  entry->key = key;
+  entry->used = 1;
+  mutex_unlock(&cache_mutex);
+}
@@ -18,7 +18,7 @@
 
 // # IMPLEMENTATION
 
-// each threat `t` we give an index `t->index` in such a way that if `t` depends on `t'`, then `t->index` is greater than `t'->index`
+// each threat `t` we give an index, its position in `threats`, in such a way that if `t` depends on `t'`, then the index of `t` is greater than the index of `t'`
 // the dependency graph of a threat `t` is a directed graph with root `t`, such that the children of each node `t'` are the threats on which `t'` depends
 // the threat sequence ending in a threat `t` consists of all the threats in the dependency graph of `t`, ordered by ascending index
 // we only look at such threat sequences. therefore, not every winning four-threat sequence will be found (todo: add example)
@@ -36,65 +36,120 @@
 typedef struct Threat
 {
   int gv, cv;  // gain vector, cost vector
-  struct Threat *parent_threats[4];  // the parent threats, ie, the threats on which this threat depends
+  int parent_threats[4];  // the indices of the parent threats, ie, the threats on which this threat depends
   char parent_count;  // the parent threat count
-  int index;  // the index of this threat in `threats`
+  int ancestors;  // the offset in `ancestor_bits` of the threats in the dependency graph of this threat, a bitset of `index / 64 + 1` words over the indices of the threats
 } Threat;
 
 // a collection of threats. used to store threats which combined may result in a new threat
 typedef struct ThreatCollection
 {
-  Threat *threats[4];
+  int threats[4];  // the indices of the threats
   int threat_count;
   int d;
   int safe;
 } ThreatCollection;
 
-static Threat **threats;  // array of all found threats
-static int threat_count;  // number of found threats
-static int threats_size;  // size of `threats`
-static int done;  // whether we should stop the search
-static int combination_stage;
-static List list;
-static int counter;
-static int counter_success;
-static int ignore_counters;
-static int unsafe_win;
+static thread_local_ Threat *threats;  // the threats found by the current search, where threat `t` is stored at `threats[t]`. the array is kept for the next searches of the thread and only grows, so a search allocates nothing unless it finds more threats than any earlier search
+static thread_local_ int threat_count;  // number of found threats
+static thread_local_ int threats_size;  // size of `threats`
+static thread_local_ ullong *ancestor_bits;  // the bitsets of the dependency graphs of the threats in `threats`
+static thread_local_ int ancestor_bits_size;  // size of `ancestor_bits`
+static thread_local_ int ancestor_bits_length;  // the number of words of `ancestor_bits` used by the threats in `threats`
+static thread_local_ int *conflict_marks;  // `conflict_marks[v] == conflict_stamp` if `v` is a gain or cost vector of a threat in the dependency graph loaded by `possible_valid_combination`. so the marks are cleared by increasing `conflict_stamp`
+static thread_local_ int conflict_stamp;
+static thread_local_ int done;  // whether we should stop the search
+static thread_local_ int combination_stage;
+static thread_local_ List list;
+static thread_local_ int counter;
+static thread_local_ int counter_success;
+static thread_local_ int ignore_counters;
+static thread_local_ int unsafe_win;
+static const ullong fours_cache_key = 0xa54ff53a5f1d36f1ULL;  // part of the cache key of the searches of `tss_fours`
+static const ullong counter_cache_key = 0x510e527fade682d1ULL;  // part of the cache key of the searches of `tss_counter`
 
 static void create_threats(ThreatCollection *);
 
 void file_tss_fours_ini()
 {
-  list_ini(&list, 9);
+  file_tss_fours_thread_ini();
 }
 
 void file_tss_fours_cleanup()
+{
+  file_tss_fours_thread_cleanup();
+}
+
+// allocates the data structures that every thread needs for the search
+void file_tss_fours_thread_ini()
+{
+  list_ini(&list, 9);
+  threats_size = 64;
+  threats = (Threat *)malloc_safe(threats_size * sizeof(Threat));
+  ancestor_bits_size = 256;
+  ancestor_bits = (ullong *)malloc_safe(ancestor_bits_size * sizeof(ullong));
+  conflict_marks = (int *)calloc_safe(size, sizeof(int));
+  conflict_stamp = 0;
+}
+
+void file_tss_fours_thread_cleanup()
 {
   list_cleanup(&list);
+  free(threats);
+  free(ancestor_bits);
+  free(conflict_marks);
 }
 
-// stores the indices of all threats in the dependency graph of `t` in ascending order in `list`
-// if `update_conflict_board` is set then it also keeps track of all the gain and cost vectors of the threats in the dependency graph, and stores this information in `conflict_board`
-static void load_dependency_graph(Threat *t, int update_conflict_board)
+// makes sure that `ancestor_bits` has room for `words` more words
+static void reserve_ancestor_bits(int words)
 {
-  int k;
-  list_ordered_add(&list, t->index);
-  if (update_conflict_board == 1)
+  while (ancestor_bits_length + words > ancestor_bits_size)
   {
-    conflict_board[t->gv] = 1;
-    conflict_board[t->cv] = 1;
+    ancestor_bits_size *= 2;
+    ancestor_bits = (ullong *)realloc_safe(ancestor_bits, ancestor_bits_size * sizeof(ullong));
   }
-  for (k = 0; k < t->parent_count; k++)
+}
+
+// returns whether threat `t` is in the dependency graph of threat `u`
+static int is_ancestor(int t, int u)
+{
+  return t <= u && ancestor_bits[threats[u].ancestors + t / 64] >> (t & 63) & 1;
+}
+
+// stores the indices of all threats in the dependency graphs of the `count` threats `ts` in ascending order in `list`
+static void load_dependency_graphs(const int *ts, int count)
+{
+  int i, k, words;
+  ullong x, *bits, *row;
+  words = 0;
+  for (k = 0; k < count; k++)
   {
-    if (!list_ordered_contains(&list, t->parent_threats[k]->index))
+    words = max_(words, ts[k] / 64 + 1);
+  }
+  // the union of the graphs is built in the unused part of `ancestor_bits`
+  reserve_ancestor_bits(words);
+  bits = ancestor_bits + ancestor_bits_length;
+  memset(bits, 0, words * sizeof(ullong));
+  for (k = 0; k < count; k++)
+  {
+    row = ancestor_bits + threats[ts[k]].ancestors;
+    for (i = 0; i <= ts[k] / 64; i++)
     {
-      load_dependency_graph(t->parent_threats[k], update_conflict_board);
+      bits[i] |= row[i];
+    }
+  }
+  list_clear(&list);
+  for (i = 0; i < words; i++)
+  {
+    for (x = bits[i]; x; x &= x - 1)
+    {
+      list_add(&list, 64 * i + ctz64(x));
     }
   }
 }
 
-// writes the information about the winning threat sequence in `list` to the result struct
-static void handle_wts(Threat *t, int safe)
+// writes the information about the winning threat sequence in `list`, or the one ending in threat `t` if `t != -1`, to the result struct
+static void handle_wts(int t, int safe)
 {
   int k, v;
   if (counter)
@@ -109,19 +164,18 @@ static void handle_wts(Threat *t, int safe)
     ignore_counters = 0;
     return;
   }
-  if (t)
+  if (t != -1)
   {
-    list_clear(&list);
-    load_dependency_graph(t, 0);
+    load_dependency_graphs(&t, 1);
   }
   result.success = 1;
   result.threat_count = list.length + 1;
   result.threats = (ResultThreat *)malloc_safe(sizeof(ResultThreat) * result.threat_count);
   for (k = 0; k < list.length; k++)
   {
-    result.threats[k].gv = threats[list.values[k]]->gv;
+    result.threats[k].gv = threats[list.values[k]].gv;
     result.threats[k].cv_count = 1;
-    result.threats[k].cvs[0] = threats[list.values[k]]->cv;
+    result.threats[k].cvs[0] = threats[list.values[k]].cv;
   }
   v = q->fives.length ? q->fives.values[0] : p->double_fours.values[0];
   result.threats[list.length].gv = v;
@@ -133,18 +187,18 @@ static void handle_wts(Threat *t, int safe)
   done = 1;
 }
 
-// checks whether the threat sequence ending in `t` is winning
+// checks whether the threat sequence ending in threat `t` is winning
 // if not, it tries to create other threats that depend on `t`
 // resembles procedure 1 from the comments at the top of this file
-static void handle_new_threat(Threat *t, int safe)
+static void handle_new_threat(int t, int safe)
 {
   ThreatCollection col;
   if (!safe && !ignore_counters)
   {
     return;
   }
-  submit_move(t->gv);
-  if (p->fours[t->cv].length >= 2)
+  submit_move(threats[t].gv);
+  if (p->fours[threats[t].cv].length >= 2)
   {
     if (ignore_counters)
     {
@@ -156,7 +210,7 @@ static void handle_new_threat(Threat *t, int safe)
       return;
     }
   }
-  submit_move(t->cv);
+  submit_move(threats[t].cv);
   if (win_in_3(pid) || (ignore_counters && p->double_fours.length))
   {
     handle_wts(t, safe && win_in_3(pid));
@@ -174,7 +228,8 @@ static void handle_new_threat(Threat *t, int safe)
 // creates a new threat with gain vector `gv` and cost vector `cv` that depends on all threats in `col`
 static void create_threat(ThreatCollection *col, int gv, int cv)
 {
-  int k, safe;
+  int k, i, safe, words;
+  ullong *row, *parent_row;
   Threat *t;
   safe = col->safe;
   if (q->fives.length && gv != q->fives.values[0])
@@ -194,32 +249,46 @@ static void create_threat(ThreatCollection *col, int gv, int cv)
   }
   if (counter && (win_board[gv] || win_board[cv]))
   {
-    handle_wts(0, safe);
+    handle_wts(-1, safe);
     return;
   }
-  t = (Threat *)calloc_safe(1, sizeof(Threat));
   if (threat_count >= threats_size)
   {
-    threats_size = max_(threats_size * 2, 8);
-    threats = (Threat **)realloc_safe(threats, threats_size * sizeof(Threat *));
+    threats_size *= 2;
+    threats = (Threat *)realloc_safe(threats, threats_size * sizeof(Threat));
   }
-  t->index = threat_count++;
-  threats[t->index] = t;
+  t = &threats[threat_count];
   t->parent_count = col->threat_count;
   for (k = 0; k < col->threat_count; k++)
   {
     t->parent_threats[k] = col->threats[k];
   }
+  // the dependency graph of the new threat is the union of the graphs of its parents, plus the threat itself
+  words = threat_count / 64 + 1;
+  reserve_ancestor_bits(words);
+  t->ancestors = ancestor_bits_length;
+  ancestor_bits_length += words;
+  row = ancestor_bits + t->ancestors;
+  memset(row, 0, words * sizeof(ullong));
+  for (k = 0; k < t->parent_count; k++)
+  {
+    parent_row = ancestor_bits + threats[t->parent_threats[k]].ancestors;
+    for (i = 0; i <= t->parent_threats[k] / 64; i++)
+    {
+      row[i] |= parent_row[i];
+    }
+  }
+  row[threat_count / 64] |= 1ULL << (threat_count & 63);
   t->gv = gv;
   t->cv = cv;
-  handle_new_threat(t, safe);
+  handle_new_threat(threat_count++, safe);
 }
 
 static void create_threats_1(ThreatCollection *col)
 {
   int gv, u, v, v2, d, d2, i, k, l, dir, sandwich, ok;
   int dirs[4] = { 1, w, 1 + w, 1 - w };
-  gv = col->threats[0]->gv;
+  gv = threats[col->threats[0]].gv;
   for (dir = 0; dir < 4; dir++)
   {
     d = dirs[dir];
@@ -297,7 +366,7 @@ static int check_ok(int gv, int v, int v2)
 static void create_threats_2(ThreatCollection *col)
 {
   int gv, u, v, v2, d, d2, i, k, l, sandwich, ok;
-  gv = col->threats[0]->gv;
+  gv = threats[col->threats[0]].gv;
   d = col->d;
   sandwich = 0;
   for (i = 0; i < 2; i++)  // loop over `d` and `-d`
@@ -335,7 +404,7 @@ static void create_threats_2(ThreatCollection *col)
         {
           for (k = 1; k < col->threat_count; k++)
           {
-            if (!check_ok(col->threats[k]->gv, v, v2))
+            if (!check_ok(threats[col->threats[k]].gv, v, v2))
             {
               ok = 0;
               break;
@@ -390,58 +459,63 @@ static void create_threats(ThreatCollection *col)
   }
 }
 
-// checks whether a threat in the dependency graph of `t` is in conflict with a threat in `list` (this is done indirectly by using `conflict_board`)
-static int conflicting_dependency_graph(Threat *t)
-{
-  int k;
-  list_ordered_add(&list, t->index);
-  if (conflict_board[t->gv] || conflict_board[t->cv])
-  {
-    return 1;
-  }
-  for (k = 0; k < t->parent_count; k++)
-  {
-    if (!list_ordered_contains(&list, t->parent_threats[k]->index))
-    {
-      if (conflicting_dependency_graph(t->parent_threats[k]))
-      {
-        return 1;
-      }
-    }
-  }
-  return 0;
-}
-
 // checks whether it may be possible to play both the threat sequences of `t1` and `t2`, and that one is not a subsequence of the other
-// this is done by checking whether the dependency graphs of `t1` and `t2` do not contain conflicting threats
-static int possible_valid_combination(Threat *t1, Threat *t2)
+// this is done by checking whether the dependency graphs of `t1` and `t2` do not contain conflicting threats. the threats that are in both graphs are not checked
+static int possible_valid_combination(int t1, int t2)
 {
-  Threat *swap;
+  int swap, i;
+  ullong x, *row1, *row2;
+  Threat *t;
   // after this swap we know for sure that the threat sequence of `t1` is not a subsequence of the threat sequence of `t2`, as `t1` is not in the dependency tree of `t2`, which follows from the fact that `t1` is found after `t2`
-  if (t2->index > t1->index)
+  if (t2 > t1)
   {
     swap = t2;
     t2 = t1;
     t1 = swap;
   }
-  board_clear(conflict_board);
-  list_clear(&list);
-  load_dependency_graph(t1, 1);  // add all threats in the dependency graph of `t1` to `list`, and all corresponding gain and cost vectors to `conflict_board`
   // check whether `t2` is a subsequence of `t1`
-  if (list_ordered_contains(&list, t2->index))
+  if (is_ancestor(t2, t1))
   {
     return 0;
   }
-  return !conflicting_dependency_graph(t2);
+  if (conflict_stamp == INT_MAX)
+  {
+    memset(conflict_marks, 0, size * sizeof(int));
+    conflict_stamp = 0;
+  }
+  conflict_stamp++;
+  row1 = ancestor_bits + threats[t1].ancestors;
+  row2 = ancestor_bits + threats[t2].ancestors;
+  for (i = 0; i <= t1 / 64; i++)
+  {
+    for (x = row1[i]; x; x &= x - 1)
+    {
+      t = &threats[64 * i + ctz64(x)];
+      conflict_marks[t->gv] = conflict_stamp;
+      conflict_marks[t->cv] = conflict_stamp;
+    }
+  }
+  for (i = 0; i <= t2 / 64; i++)
+  {
+    for (x = row2[i] & ~row1[i]; x; x &= x - 1)
+    {
+      t = &threats[64 * i + ctz64(x)];
+      if (conflict_marks[t->gv] == conflict_stamp || conflict_marks[t->cv] == conflict_stamp)
+      {
+        return 0;
+      }
+    }
+  }
+  return 1;
 }
 
 // tries to add `t` to `col` and returns whether this was successful
-static int add_threat(ThreatCollection *col, Threat *t)
+static int add_threat(ThreatCollection *col, int t)
 {
   int k, d, v;
   if (col->threat_count)
   {
-    d = get_d(col->threats[0]->gv, t->gv);
+    d = get_d(threats[col->threats[0]].gv, threats[t].gv);
     if (!d)
     {
       return 0;
@@ -454,14 +528,14 @@ static int add_threat(ThreatCollection *col, Threat *t)
       }
       for (k = 1; k < col->threat_count; k++)
       {
-        if (!get_d(col->threats[k]->gv, t->gv))
+        if (!get_d(threats[col->threats[k]].gv, threats[t].gv))
         {
           return 0;
         }
       }
     }
-    v = col->threats[0]->gv + d;
-    while (v != t->gv)
+    v = threats[col->threats[0]].gv + d;
+    while (v != threats[t].gv)
     {
       if (board[v] && board[v] != pid)
       {
@@ -491,20 +565,16 @@ static int do_all_moves(ThreatCollection *col)
   int k;
   Threat *t;
   col->safe = 1;
-  list_clear(&list);
-  for (k = 0; k < col->threat_count; k++)
-  {
-    load_dependency_graph(col->threats[k], 0);
-  }
+  load_dependency_graphs(col->threats, col->threat_count);
   for (k = 0; k < list.length; k++)
   {
-    t = threats[list.values[k]];
+    t = &threats[list.values[k]];
     if (ignore_counters && q->five_count[t->cv])
     {
       return 0;
     }
     submit_move(t->gv);
-    if (p->fours[t->cv].length >= 2 || (p->fours[t->cv].length && k + 1 < list.length && p->fours[t->cv].values[0] != threats[list.values[k + 1]]->gv))
+    if (p->fours[t->cv].length >= 2 || (p->fours[t->cv].length && k + 1 < list.length && p->fours[t->cv].values[0] != threats[list.values[k + 1]].gv))
     {
       if (ignore_counters)
       {
@@ -519,7 +589,7 @@ static int do_all_moves(ThreatCollection *col)
     if (win_in_3(pid) || (ignore_counters && p->double_fours.length))
     {
       list.length = k + 1;
-      handle_wts(0, col->safe && win_in_3(pid));
+      handle_wts(-1, col->safe && win_in_3(pid));
       return 0;
     }
   }
@@ -529,13 +599,11 @@ static int do_all_moves(ThreatCollection *col)
 // tries to make new threats by combining two or three threats
 static void combine(int min_index, int max_index, ThreatCollection *col)
 {
-  Threat *t;
-  int k, *moves_before;
-  moves_before = copy_moves();
+  int k, mark;
+  mark = board_mark();
   for (k = max_index; k >= min_index; k--)
   {
-    t = threats[k];
-    if (add_threat(col, t))
+    if (add_threat(col, k))
     {
       if (col->threat_count >= 2)
       {
@@ -543,7 +611,7 @@ static void combine(int min_index, int max_index, ThreatCollection *col)
         {
           create_threats(col);
         }
-        restore_moves(moves_before);
+        board_rollback(mark);
       }
       if (!done && col->threat_count < 3)
       {
@@ -556,31 +624,17 @@ static void combine(int min_index, int max_index, ThreatCollection *col)
       }
     }
   }
-  free(moves_before);
 }
 
-static void cleanup()
-{
-  int k;
-  for (k = 0; k < threat_count; k++)
-  {
-    free(threats[k]);
-  }
-  free(threats);
-}
-
-// searches for a winning four-threat sequence. returns whether successful. additional information will be written to `result`
-// assumes there is no winner within 2 moves
-int tss_fours(char id)
+static int search(char id)
 {
   ThreatCollection col;
   int threat_count_before, prev_threat_count;
   char pid_before;
   pid_before = set_p(id);
   threat_count = 0;
+  ancestor_bits_length = 0;
   done = 0;
-  threats = 0;
-  threats_size = 0;
   combination_stage = 0;
   col.threat_count = 0;
   col.safe = 1;
@@ -597,7 +651,7 @@ int tss_fours(char id)
   if (win_in_3(pid) || (ignore_counters && p->double_fours.length))
   {
     list_clear(&list);
-    handle_wts(0, win_in_3(pid));
+    handle_wts(-1, win_in_3(pid));
   }
   else
   {
@@ -613,24 +667,56 @@ int tss_fours(char id)
       } while (!done && threat_count != threat_count_before);
     }
   }
-  cleanup();
   set_p(pid_before);
   return result.success;
 }
 
+// searches for a winning four-threat sequence. returns whether successful. additional information will be written to `result`
+// assumes there is no winner within 2 moves
+int tss_fours(char id)
+{
+  ullong key;
+  key = tss_cache_key(id, fours_cache_key);
+  if (tss_cache_probe(key, &result))
+  {
+    return result.success;
+  }
+  search(id);
+  if (!out_of_time)
+  {
+    tss_cache_store(key, &result);
+  }
+  return result.success;
+}
+
 int tss_fours_unsafe(char id)
 {
   ignore_counters = 1;
   unsafe_win = 0;
-  tss_fours(id);
+  search(id);
   ignore_counters = 0;
   return unsafe_win;
 }
 
+// returns whether player `id` has a four-threat sequence that wins, or that blocks the possibly winning threat sequence on `win_board` of the opponent
 int tss_counter(char id)
 {
+  ullong key;
+  TssResult cached;
+  // the outcome depends on the squares of the threat sequence of the opponent
+  key = tss_cache_key(id, counter_cache_key ^ win_board_key);
+  if (tss_cache_probe(key, &cached))
+  {
+    return cached.success;
+  }
   counter = 1;
-  tss_fours(id);
+  search(id);
   counter = 0;
+  if (!out_of_time)
+  {
+    memset(&cached, 0, sizeof(TssResult));
+    cached.success = counter_success;
+    tss_cache_store(key, &cached);
+  }
   return counter_success;
 }